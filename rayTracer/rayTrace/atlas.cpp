@@ -0,0 +1,116 @@
+#include "atlas.h"
+
+#include <algorithm>
+#include <climits>
+
+struct FreeRect {
+	int x, y, width, height, layer;
+};
+
+static int alignUp(int v) {
+	return (v + ATLAS_ALIGN - 1) / ATLAS_ALIGN * ATLAS_ALIGN;
+}
+
+static bool contains(const FreeRect& a, const FreeRect& b) {
+	return a.layer == b.layer && b.x >= a.x && b.y >= a.y && b.x + b.width <= a.x + a.width && b.y + b.height <= a.y + a.height;
+}
+
+//splits every free rect overlapping the placed one into up to four maximal pieces around it
+static void splitFree(std::vector<FreeRect>& freeRects, const FreeRect& used) {
+	std::vector<FreeRect> next;
+	for (const FreeRect& f : freeRects) {
+		if (f.layer != used.layer || used.x >= f.x + f.width || used.x + used.width <= f.x || used.y >= f.y + f.height || used.y + used.height <= f.y) {
+			next.push_back(f);
+			continue;
+		}
+		if (used.x > f.x)
+			next.push_back({ f.x, f.y, used.x - f.x, f.height, f.layer });
+		if (used.x + used.width < f.x + f.width)
+			next.push_back({ used.x + used.width, f.y, f.x + f.width - used.x - used.width, f.height, f.layer });
+		if (used.y > f.y)
+			next.push_back({ f.x, f.y, f.width, used.y - f.y, f.layer });
+		if (used.y + used.height < f.y + f.height)
+			next.push_back({ f.x, used.y + used.height, f.width, f.y + f.height - used.y - used.height, f.layer });
+	}
+
+	//drop free rects contained in another
+	freeRects.clear();
+	for (size_t i = 0; i < next.size(); ++i) {
+		bool redundant = false;
+		for (size_t j = 0; j < next.size() && !redundant; ++j)
+			if (i != j && contains(next[j], next[i]) && (!contains(next[i], next[j]) || j < i))
+				redundant = true;
+		if (!redundant)
+			freeRects.push_back(next[i]);
+	}
+}
+
+int packAtlas(const std::vector<int>& widths, const std::vector<int>& heights, int pageSize, std::vector<AtlasRect>& rects) {
+	int count = (int)widths.size();
+	rects.assign(count, AtlasRect());
+
+	//largest first packs tightest
+	std::vector<int> order(count);
+	for (int i = 0; i < count; ++i) {
+		order[i] = i;
+		if (alignUp(widths[i]) > pageSize || alignUp(heights[i]) > pageSize)
+			return -1;
+	}
+	std::sort(order.begin(), order.end(), [&](int a, int b) {
+		return std::max(widths[a], heights[a]) > std::max(widths[b], heights[b]);
+	});
+
+	std::vector<FreeRect> freeRects;
+	int layers = 0;
+	for (int i : order) {
+		int w = alignUp(widths[i]), h = alignUp(heights[i]);
+
+		int best = -1, bestShort = INT_MAX, bestLong = INT_MAX;
+		for (int f = 0; f < (int)freeRects.size(); ++f) {
+			const FreeRect& r = freeRects[f];
+			if (r.width < w || r.height < h)
+				continue;
+			int shortSide = std::min(r.width - w, r.height - h), longSide = std::max(r.width - w, r.height - h);
+			if (shortSide < bestShort || (shortSide == bestShort && longSide < bestLong)) {
+				best = f;
+				bestShort = shortSide;
+				bestLong = longSide;
+			}
+		}
+		if (best == -1) {
+			freeRects.push_back({ 0, 0, pageSize, pageSize, layers++ });
+			best = (int)freeRects.size() - 1;
+		}
+
+		FreeRect used = { freeRects[best].x, freeRects[best].y, w, h, freeRects[best].layer };
+		rects[i] = { used.x, used.y, used.layer, widths[i], heights[i] };
+		splitFree(freeRects, used);
+	}
+
+	return layers;
+}
+
+int packAtlasBest(const std::vector<int>& widths, const std::vector<int>& heights, int maxPageSize, std::vector<AtlasRect>& rects, int& pageSize) {
+	int largest = 1;
+	for (size_t i = 0; i < widths.size(); ++i)
+		largest = std::max(largest, std::max(alignUp(widths[i]), alignUp(heights[i])));
+
+	int layers = -1;
+	long long bestTexels = LLONG_MAX;
+	std::vector<AtlasRect> candidate;
+	for (int size = ATLAS_ALIGN; size <= maxPageSize; size *= 2) {
+		if (size < largest)
+			continue;
+		int used = packAtlas(widths, heights, size, candidate);
+		if (used < 0)
+			continue;
+		long long texels = (long long)size * size * used;
+		if (texels < bestTexels) {
+			bestTexels = texels;
+			layers = used;
+			pageSize = size;
+			rects = candidate;
+		}
+	}
+	return layers;
+}
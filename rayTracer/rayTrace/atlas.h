@@ -0,0 +1,19 @@
+#pragma once
+#include <vector>
+
+//texture sizes and positions are rounded up to this many texels, so the first log2(ATLAS_ALIGN) mip levels stay inside their rects
+#define ATLAS_ALIGN 32
+
+//where a texture landed in the array
+struct AtlasRect {
+	int x, y, layer;
+	int width, height;
+};
+
+//packs width x height rectangles into square layers of pageSize with maxrects, best short side fit.
+//returns the number of layers used, or -1 if a rectangle is larger than a layer
+int packAtlas(const std::vector<int>& widths, const std::vector<int>& heights, int pageSize, std::vector<AtlasRect>& rects);
+
+//packs with every power of two layer size up to maxPageSize and keeps the one wasting the fewest texels.
+//returns the number of layers, pageSize is set to the chosen size
+int packAtlasBest(const std::vector<int>& widths, const std::vector<int>& heights, int maxPageSize, std::vector<AtlasRect>& rects, int& pageSize);
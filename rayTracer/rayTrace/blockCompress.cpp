@@ -0,0 +1,581 @@
+#include "blockCompress.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <soil.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BLOCK_SSE
+#include <emmintrin.h>
+#endif
+
+const char* formatName(BlockFormat format) {
+	switch (format) {
+	case FORMAT_BC1: return "BC1";
+	case FORMAT_BC3: return "BC3";
+	case FORMAT_BC7: return "BC7";
+	default: return "RGBA8";
+	}
+}
+
+GLenum formatInternal(BlockFormat format) {
+	switch (format) {
+	case FORMAT_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	case FORMAT_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case FORMAT_BC7: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	default: return GL_RGBA8;
+	}
+}
+
+int formatBlockBytes(BlockFormat format) {
+	switch (format) {
+	case FORMAT_BC1: return 8;
+	case FORMAT_BC3: return 16;
+	case FORMAT_BC7: return 16;
+	default: return 4;
+	}
+}
+
+size_t formatImageBytes(BlockFormat format, int width, int height) {
+	if (format == FORMAT_RGBA8)
+		return (size_t)width * height * 4;
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * formatBlockBytes(format);
+}
+
+bool formatSupported(BlockFormat format) {
+	switch (format) {
+	case FORMAT_BC1:
+	case FORMAT_BC3: return GLEW_EXT_texture_compression_s3tc != 0;
+	case FORMAT_BC7: return GLEW_ARB_texture_compression_bptc != 0 || GLEW_VERSION_4_2 != 0;
+	default: return true;
+	}
+}
+
+//one 4x4 block, rgba per texel
+struct Block {
+	float px[16][4];
+};
+
+static void loadBlock(const unsigned char* pixels, int width, int height, int bx, int by, Block& block) {
+	for (int y = 0; y < 4; ++y)
+		for (int x = 0; x < 4; ++x) {
+			int sx = std::min(bx * 4 + x, width - 1), sy = std::min(by * 4 + y, height - 1);
+			for (int c = 0; c < 4; ++c)
+				block.px[y * 4 + x][c] = pixels[((size_t)sy * width + sx) * 4 + c];
+		}
+}
+
+//nearest palette entry for every texel, channels scaled by weights. returns the summed squared error
+static float selectIndices(const Block& block, const float palette[][4], int count, const float weights[4], int indices[16]) {
+	float total = 0;
+#ifdef BLOCK_SSE
+	//four texels at a time, one channel per register
+	for (int g = 0; g < 4; ++g) {
+		const float (*px)[4] = block.px + 4 * g;
+		__m128 ch[4];
+		for (int c = 0; c < 4; ++c)
+			ch[c] = _mm_set_ps(px[3][c], px[2][c], px[1][c], px[0][c]);
+
+		__m128 bestErr = _mm_set1_ps(FLT_MAX);
+		__m128i bestIdx = _mm_setzero_si128();
+		for (int j = 0; j < count; ++j) {
+			__m128 err = _mm_setzero_ps();
+			for (int c = 0; c < 4; ++c) {
+				__m128 d = _mm_sub_ps(ch[c], _mm_set1_ps(palette[j][c]));
+				err = _mm_add_ps(err, _mm_mul_ps(_mm_mul_ps(d, d), _mm_set1_ps(weights[c])));
+			}
+			__m128i less = _mm_castps_si128(_mm_cmplt_ps(err, bestErr));
+			bestErr = _mm_min_ps(err, bestErr);
+			bestIdx = _mm_or_si128(_mm_and_si128(less, _mm_set1_epi32(j)), _mm_andnot_si128(less, bestIdx));
+		}
+
+		float errs[4];
+		int idx[4];
+		_mm_storeu_ps(errs, bestErr);
+		_mm_storeu_si128((__m128i*)idx, bestIdx);
+		for (int k = 0; k < 4; ++k) {
+			indices[4 * g + k] = idx[k];
+			total += errs[k];
+		}
+	}
+#else
+	for (int i = 0; i < 16; ++i) {
+		float best = FLT_MAX;
+		int bestIdx = 0;
+		for (int j = 0; j < count; ++j) {
+			float err = 0;
+			for (int c = 0; c < 4; ++c) {
+				float d = block.px[i][c] - palette[j][c];
+				err += d * d * weights[c];
+			}
+			if (err < best) {
+				best = err;
+				bestIdx = j;
+			}
+		}
+		indices[i] = bestIdx;
+		total += best;
+	}
+#endif
+	return total;
+}
+
+//endpoints at the extremes of the block's principal axis
+static void principalEndpoints(const Block& block, int channels, float e0[4], float e1[4]) {
+	float mean[4] = { 0, 0, 0, 0 };
+	for (int i = 0; i < 16; ++i)
+		for (int c = 0; c < channels; ++c)
+			mean[c] += block.px[i][c] / 16;
+
+	float cov[4][4] = {};
+	for (int i = 0; i < 16; ++i)
+		for (int a = 0; a < channels; ++a)
+			for (int b = 0; b < channels; ++b)
+				cov[a][b] += (block.px[i][a] - mean[a]) * (block.px[i][b] - mean[b]);
+
+	//power iteration
+	float axis[4] = { 1, 1, 1, channels == 4 ? 1.0f : 0.0f };
+	for (int iter = 0; iter < 8; ++iter) {
+		float next[4] = { 0, 0, 0, 0 };
+		float largest = 0;
+		for (int a = 0; a < channels; ++a) {
+			for (int b = 0; b < channels; ++b)
+				next[a] += cov[a][b] * axis[b];
+			largest = std::max(largest, std::fabs(next[a]));
+		}
+		if (largest < 1e-6f)
+			break;
+		for (int a = 0; a < channels; ++a)
+			axis[a] = next[a] / largest;
+	}
+
+	float len2 = 0;
+	for (int c = 0; c < channels; ++c)
+		len2 += axis[c] * axis[c];
+	float tMin = 0, tMax = 0;
+	for (int i = 0; i < 16; ++i) {
+		float t = 0;
+		for (int c = 0; c < channels; ++c)
+			t += (block.px[i][c] - mean[c]) * axis[c];
+		t /= len2;
+		tMin = std::min(tMin, t);
+		tMax = std::max(tMax, t);
+	}
+
+	for (int c = 0; c < 4; ++c) {
+		float a = c < channels ? axis[c] : 0.0f;
+		float m = c < channels ? mean[c] : 255.0f;
+		e0[c] = std::min(std::max(m + a * tMin, 0.0f), 255.0f);
+		e1[c] = std::min(std::max(m + a * tMax, 0.0f), 255.0f);
+	}
+}
+
+//least squares endpoints for fixed indices, weight[i] is how far palette entry i sits towards e1
+static void refitEndpoints(const Block& block, const int indices[16], const float weight[], int channels, float e0[4], float e1[4]) {
+	float a = 0, b = 0, c = 0, x0[4] = { 0, 0, 0, 0 }, x1[4] = { 0, 0, 0, 0 };
+	for (int i = 0; i < 16; ++i) {
+		float w = weight[indices[i]];
+		a += (1 - w) * (1 - w);
+		b += (1 - w) * w;
+		c += w * w;
+		for (int k = 0; k < channels; ++k) {
+			x0[k] += (1 - w) * block.px[i][k];
+			x1[k] += w * block.px[i][k];
+		}
+	}
+	float det = a * c - b * b;
+	if (std::fabs(det) < 1e-6f)
+		return;
+	for (int k = 0; k < channels; ++k) {
+		e0[k] = std::min(std::max((c * x0[k] - b * x1[k]) / det, 0.0f), 255.0f);
+		e1[k] = std::min(std::max((a * x1[k] - b * x0[k]) / det, 0.0f), 255.0f);
+	}
+}
+
+//bc1
+
+static unsigned short to565(const float c[4]) {
+	int r = std::min(std::max((int)(c[0] * 31 / 255 + 0.5f), 0), 31);
+	int g = std::min(std::max((int)(c[1] * 63 / 255 + 0.5f), 0), 63);
+	int b = std::min(std::max((int)(c[2] * 31 / 255 + 0.5f), 0), 31);
+	return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+static void from565(unsigned short v, float c[4]) {
+	int r = v >> 11, g = (v >> 5) & 63, b = v & 31;
+	c[0] = (float)((r << 3) | (r >> 2));
+	c[1] = (float)((g << 2) | (g >> 4));
+	c[2] = (float)((b << 3) | (b >> 2));
+	c[3] = 255;
+}
+
+//4 color palette, entries 2 and 3 at thirds between the endpoints
+static void bc1Palette(unsigned short c0, unsigned short c1, float palette[4][4]) {
+	from565(c0, palette[0]);
+	from565(c1, palette[1]);
+	for (int c = 0; c < 4; ++c) {
+		palette[2][c] = (float)(((int)palette[0][c] * 2 + (int)palette[1][c] + 1) / 3);
+		palette[3][c] = (float)(((int)palette[0][c] + (int)palette[1][c] * 2 + 1) / 3);
+	}
+}
+
+static void encodeBC1(const Block& block, unsigned char out[8]) {
+	static const float rgb[4] = { 1, 1, 1, 0 };
+	static const float weight[4] = { 0, 1, 1.0f / 3, 2.0f / 3 };
+
+	float e0[4], e1[4];
+	principalEndpoints(block, 3, e0, e1);
+
+	float bestErr = FLT_MAX;
+	unsigned short best0 = 0, best1 = 0;
+	int bestIdx[16] = {};
+	for (int pass = 0; pass < 2; ++pass) {
+		unsigned short c0 = to565(e0), c1 = to565(e1);
+		if (c0 < c1)
+			std::swap(c0, c1);
+
+		int indices[16] = {};
+		float err;
+		float palette[4][4];
+		bc1Palette(c0, c1, palette);
+		if (c0 == c1)
+			err = selectIndices(block, palette, 1, rgb, indices);
+		else
+			err = selectIndices(block, palette, 4, rgb, indices);
+
+		if (err < bestErr) {
+			bestErr = err;
+			best0 = c0;
+			best1 = c1;
+			memcpy(bestIdx, indices, sizeof(indices));
+		}
+		if (c0 == c1)
+			break;
+		from565(c0, e0);
+		from565(c1, e1);
+		refitEndpoints(block, indices, weight, 3, e0, e1);
+	}
+
+	out[0] = best0 & 0xFF; out[1] = best0 >> 8;
+	out[2] = best1 & 0xFF; out[3] = best1 >> 8;
+	unsigned int bits = 0;
+	for (int i = 0; i < 16; ++i)
+		bits |= (unsigned int)bestIdx[i] << (2 * i);
+	for (int k = 0; k < 4; ++k)
+		out[4 + k] = (bits >> (8 * k)) & 0xFF;
+}
+
+static void decodeBC1(const unsigned char in[8], unsigned char px[16][4]) {
+	unsigned short c0 = in[0] | (in[1] << 8), c1 = in[2] | (in[3] << 8);
+	float palette[4][4];
+	bc1Palette(c0, c1, palette);
+	if (c0 <= c1) {
+		//3 color mode, not written by encodeBC1
+		for (int c = 0; c < 3; ++c)
+			palette[2][c] = (float)(((int)palette[0][c] + (int)palette[1][c]) / 2);
+		palette[3][0] = palette[3][1] = palette[3][2] = palette[3][3] = 0;
+	}
+	unsigned int bits = in[4] | (in[5] << 8) | (in[6] << 16) | ((unsigned int)in[7] << 24);
+	for (int i = 0; i < 16; ++i)
+		for (int c = 0; c < 4; ++c)
+			px[i][c] = (unsigned char)palette[(bits >> (2 * i)) & 3][c];
+}
+
+//bc4 style alpha for bc3
+
+static void alphaPalette(int a0, int a1, int palette[8]) {
+	palette[0] = a0;
+	palette[1] = a1;
+	if (a0 > a1) {
+		for (int k = 2; k < 8; ++k)
+			palette[k] = ((8 - k) * a0 + (k - 1) * a1) / 7;
+	}
+	else {
+		for (int k = 2; k < 6; ++k)
+			palette[k] = ((6 - k) * a0 + (k - 1) * a1) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+}
+
+static void encodeAlpha(const Block& block, unsigned char out[8]) {
+	float lo = 255, hi = 0;
+	for (int i = 0; i < 16; ++i) {
+		lo = std::min(lo, block.px[i][3]);
+		hi = std::max(hi, block.px[i][3]);
+	}
+	int a0 = (int)(hi + 0.5f), a1 = (int)(lo + 0.5f);
+	int palette[8];
+	alphaPalette(a0, a1, palette);
+
+	unsigned long long bits = 0;
+	for (int i = 0; i < 16; ++i) {
+		int best = 0;
+		float bestErr = FLT_MAX;
+		for (int k = 0; k < (a0 > a1 ? 8 : 1); ++k) {
+			float d = block.px[i][3] - palette[k];
+			if (d * d < bestErr) {
+				bestErr = d * d;
+				best = k;
+			}
+		}
+		bits |= (unsigned long long)best << (3 * i);
+	}
+
+	out[0] = (unsigned char)a0;
+	out[1] = (unsigned char)a1;
+	for (int k = 0; k < 6; ++k)
+		out[2 + k] = (bits >> (8 * k)) & 0xFF;
+}
+
+static void decodeAlpha(const unsigned char in[8], unsigned char px[16][4]) {
+	int palette[8];
+	alphaPalette(in[0], in[1], palette);
+	unsigned long long bits = 0;
+	for (int k = 0; k < 6; ++k)
+		bits |= (unsigned long long)in[2 + k] << (8 * k);
+	for (int i = 0; i < 16; ++i)
+		px[i][3] = (unsigned char)palette[(bits >> (3 * i)) & 7];
+}
+
+//bc7 mode 6
+
+static const int bc7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct BitWriter {
+	unsigned char* out;
+	int pos;
+	void put(unsigned int value, int bits) {
+		for (int i = 0; i < bits; ++i, ++pos)
+			if ((value >> i) & 1)
+				out[pos >> 3] |= 1 << (pos & 7);
+	}
+};
+
+struct BitReader {
+	const unsigned char* in;
+	int pos;
+	unsigned int get(int bits) {
+		unsigned int value = 0;
+		for (int i = 0; i < bits; ++i, ++pos)
+			value |= ((in[pos >> 3] >> (pos & 7)) & 1) << i;
+		return value;
+	}
+};
+
+static void bc7Palette(const int ep0[4], const int ep1[4], float palette[16][4]) {
+	for (int i = 0; i < 16; ++i)
+		for (int c = 0; c < 4; ++c)
+			palette[i][c] = (float)(((64 - bc7Weights[i]) * ep0[c] + bc7Weights[i] * ep1[c] + 32) >> 6);
+}
+
+static void encodeBC7(const Block& block, unsigned char out[16]) {
+	static const float rgba[4] = { 1, 1, 1, 1 };
+	float weight[16];
+	for (int i = 0; i < 16; ++i)
+		weight[i] = bc7Weights[i] / 64.0f;
+
+	float e0[4], e1[4];
+	principalEndpoints(block, 4, e0, e1);
+
+	float bestErr = FLT_MAX;
+	int bestQ[2][4] = {}, bestP[2] = {}, bestIdx[16] = {};
+	for (int pass = 0; pass < 2; ++pass) {
+		int passIdx[16] = {};
+		float passErr = FLT_MAX;
+		//try every pair of p bits, endpoints are 7 bits plus the shared low bit
+		for (int p = 0; p < 4; ++p) {
+			int pbit[2] = { p & 1, p >> 1 };
+			int q[2][4], ep[2][4];
+			for (int c = 0; c < 4; ++c) {
+				q[0][c] = std::min(std::max((int)((e0[c] - pbit[0]) / 2 + 0.5f), 0), 127);
+				q[1][c] = std::min(std::max((int)((e1[c] - pbit[1]) / 2 + 0.5f), 0), 127);
+				ep[0][c] = (q[0][c] << 1) | pbit[0];
+				ep[1][c] = (q[1][c] << 1) | pbit[1];
+			}
+			float palette[16][4];
+			bc7Palette(ep[0], ep[1], palette);
+			int indices[16];
+			float err = selectIndices(block, palette, 16, rgba, indices);
+			if (err < passErr) {
+				passErr = err;
+				memcpy(passIdx, indices, sizeof(indices));
+			}
+			if (err < bestErr) {
+				bestErr = err;
+				memcpy(bestQ, q, sizeof(q));
+				bestP[0] = pbit[0]; bestP[1] = pbit[1];
+				memcpy(bestIdx, indices, sizeof(indices));
+			}
+		}
+		refitEndpoints(block, passIdx, weight, 4, e0, e1);
+	}
+
+	//the anchor index drops its top bit, so it must be below 8
+	if (bestIdx[0] & 8) {
+		for (int c = 0; c < 4; ++c)
+			std::swap(bestQ[0][c], bestQ[1][c]);
+		std::swap(bestP[0], bestP[1]);
+		for (int i = 0; i < 16; ++i)
+			bestIdx[i] = 15 - bestIdx[i];
+	}
+
+	memset(out, 0, 16);
+	BitWriter writer = { out, 0 };
+	writer.put(1 << 6, 7);
+	for (int c = 0; c < 4; ++c) {
+		writer.put(bestQ[0][c], 7);
+		writer.put(bestQ[1][c], 7);
+	}
+	writer.put(bestP[0], 1);
+	writer.put(bestP[1], 1);
+	writer.put(bestIdx[0], 3);
+	for (int i = 1; i < 16; ++i)
+		writer.put(bestIdx[i], 4);
+}
+
+static void decodeBC7(const unsigned char in[16], unsigned char px[16][4]) {
+	if ((in[0] & 0x7F) != 0x40) {
+		//only mode 6 is ever written
+		memset(px, 0, 16 * 4);
+		return;
+	}
+
+	BitReader reader = { in, 7 };
+	int q[2][4], p[2];
+	for (int c = 0; c < 4; ++c) {
+		q[0][c] = reader.get(7);
+		q[1][c] = reader.get(7);
+	}
+	p[0] = reader.get(1);
+	p[1] = reader.get(1);
+
+	int ep[2][4];
+	for (int c = 0; c < 4; ++c) {
+		ep[0][c] = (q[0][c] << 1) | p[0];
+		ep[1][c] = (q[1][c] << 1) | p[1];
+	}
+	float palette[16][4];
+	bc7Palette(ep[0], ep[1], palette);
+
+	for (int i = 0; i < 16; ++i) {
+		int idx = reader.get(i == 0 ? 3 : 4);
+		for (int c = 0; c < 4; ++c)
+			px[i][c] = (unsigned char)palette[idx][c];
+	}
+}
+
+void compressImage(const unsigned char* pixels, int width, int height, BlockFormat format, std::vector<unsigned char>& out, int threadCount) {
+	out.resize(formatImageBytes(format, width, height));
+	if (format == FORMAT_RGBA8) {
+		memcpy(out.data(), pixels, out.size());
+		return;
+	}
+
+	int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+	int blockBytes = formatBlockBytes(format);
+	auto encodeRows = [&](int firstRow, int lastRow) {
+		Block block;
+		for (int by = firstRow; by < lastRow; ++by)
+			for (int bx = 0; bx < blocksX; ++bx) {
+				loadBlock(pixels, width, height, bx, by, block);
+				unsigned char* dst = &out[((size_t)by * blocksX + bx) * blockBytes];
+				if (format == FORMAT_BC1)
+					encodeBC1(block, dst);
+				else if (format == FORMAT_BC3) {
+					encodeAlpha(block, dst);
+					encodeBC1(block, dst + 8);
+				}
+				else
+					encodeBC7(block, dst);
+			}
+	};
+
+	if (threadCount <= 0)
+		threadCount = (int)std::max(1u, std::thread::hardware_concurrency());
+	threadCount = std::min(threadCount, blocksY);
+	if (threadCount <= 1) {
+		encodeRows(0, blocksY);
+		return;
+	}
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < threadCount; ++t)
+		threads.push_back(std::thread(encodeRows, blocksY * t / threadCount, blocksY * (t + 1) / threadCount));
+	for (std::thread& thread : threads)
+		thread.join();
+}
+
+void decompressImage(const unsigned char* blocks, int width, int height, BlockFormat format, std::vector<unsigned char>& out) {
+	out.resize((size_t)width * height * 4);
+	if (format == FORMAT_RGBA8) {
+		memcpy(out.data(), blocks, out.size());
+		return;
+	}
+
+	int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+	int blockBytes = formatBlockBytes(format);
+	for (int by = 0; by < blocksY; ++by)
+		for (int bx = 0; bx < blocksX; ++bx) {
+			const unsigned char* src = blocks + ((size_t)by * blocksX + bx) * blockBytes;
+			unsigned char px[16][4];
+			if (format == FORMAT_BC1)
+				decodeBC1(src, px);
+			else if (format == FORMAT_BC3) {
+				decodeBC1(src + 8, px);
+				decodeAlpha(src, px);
+			}
+			else
+				decodeBC7(src, px);
+
+			for (int y = 0; y < 4; ++y)
+				for (int x = 0; x < 4; ++x) {
+					int dx = bx * 4 + x, dy = by * 4 + y;
+					if (dx < width && dy < height)
+						memcpy(&out[((size_t)dy * width + dx) * 4], px[y * 4 + x], 4);
+				}
+		}
+}
+
+double imagePSNR(const unsigned char* a, const unsigned char* b, int width, int height) {
+	double sum = 0;
+	for (size_t i = 0; i < (size_t)width * height; ++i)
+		for (int c = 0; c < 3; ++c) {
+			double d = (double)a[4 * i + c] - b[4 * i + c];
+			sum += d * d;
+		}
+	double mse = sum / ((double)width * height * 3);
+	if (mse == 0)
+		return INFINITY;
+	return 10 * std::log10(255.0 * 255.0 / mse);
+}
+
+void benchmarkCompression(const char filename[]) {
+	int width, height;
+	unsigned char* pixels = SOIL_load_image(filename, &width, &height, 0, SOIL_LOAD_RGBA);
+	if (pixels == nullptr) {
+		printf("benchmarkCompression: could not load %s\n", filename);
+		return;
+	}
+
+	int threads = (int)std::max(1u, std::thread::hardware_concurrency());
+	printf("compression benchmark: %s, %dx%d, %d threads\n", filename, width, height, threads);
+	const BlockFormat formats[3] = { FORMAT_BC1, FORMAT_BC3, FORMAT_BC7 };
+	for (BlockFormat format : formats) {
+		std::vector<unsigned char> blocks, decoded;
+		auto start = std::chrono::steady_clock::now();
+		compressImage(pixels, width, height, format, blocks, threads);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		decompressImage(blocks.data(), width, height, format, decoded);
+
+		printf("  %s: %.2f Mtexels/s, %.2f dB, %.0fx smaller than RGBA8\n", formatName(format), width * height / elapsed.count() * 1e-6,
+			imagePSNR(pixels, decoded.data(), width, height), (double)width * height * 4 / blocks.size());
+	}
+
+	SOIL_free_image_data(pixels);
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <vector>
+#include <GL/glew.h>
+
+//texture formats the loader can store layers in. bc7 only uses mode 6, one rgba subset with 4 bit indices
+enum BlockFormat { FORMAT_RGBA8, FORMAT_BC1, FORMAT_BC3, FORMAT_BC7 };
+
+const char* formatName(BlockFormat format);
+GLenum formatInternal(BlockFormat format);
+//bytes per 4x4 block, or per texel for rgba8
+int formatBlockBytes(BlockFormat format);
+//bytes needed for a width x height image
+size_t formatImageBytes(BlockFormat format, int width, int height);
+//false if the current GL context cannot sample the format
+bool formatSupported(BlockFormat format);
+
+//compresses rgba pixels into 4x4 blocks, edge blocks repeat the last row and column. rows of blocks are split over threadCount threads
+void compressImage(const unsigned char* pixels, int width, int height, BlockFormat format, std::vector<unsigned char>& out, int threadCount = 0);
+//expands blocks written by compressImage back to rgba pixels
+void decompressImage(const unsigned char* blocks, int width, int height, BlockFormat format, std::vector<unsigned char>& out);
+//peak signal to noise ratio over rgb, in dB
+double imagePSNR(const unsigned char* a, const unsigned char* b, int width, int height);
+
+//prints encode throughput and quality of every format on one image
+void benchmarkCompression(const char filename[]);
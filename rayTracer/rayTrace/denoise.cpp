@@ -0,0 +1,118 @@
+#include "denoise.h"
+#include "parallel.h"
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <emmintrin.h>
+
+//same tuning as the defaults in denoise.comp
+static const float SIGMA_DEPTH = 1.0f, SIGMA_NORMAL = 128.0f, SIGMA_LUMINANCE = 4.0f;
+
+static __m128 texel(const float* image, int width, int x, int y) {
+	return _mm_loadu_ps(&image[4 * ((size_t)y * width + x)]);
+}
+
+static float luminance(__m128 c) {
+	float v[4];
+	_mm_storeu_ps(v, c);
+	return 0.2126f * v[0] + 0.7152f * v[1] + 0.0722f * v[2];
+}
+
+//black surfaces are filtered as if barely reflecting, like the shader
+static __m128 albedoAt(const float* albedo, int width, int x, int y) {
+	return _mm_max_ps(texel(albedo, width, x, y), _mm_set1_ps(0.01f));
+}
+
+//DENOISE_PASS 0: lighting without the albedo, and the variance of its luminance over the 3x3 in w
+static void demodulate(const float* color, const float* albedo, int width, int height, float* dst, int threadCount) {
+	forRows(height, threadCount, [&](int y) {
+		for (int x = 0; x < width; ++x) {
+			float m1 = 0.0f, m2 = 0.0f;
+			for (int dy = -1; dy <= 1; ++dy)
+				for (int dx = -1; dx <= 1; ++dx) {
+					int qx = std::min(std::max(x + dx, 0), width - 1), qy = std::min(std::max(y + dy, 0), height - 1);
+					float l = luminance(_mm_div_ps(texel(color, width, qx, qy), albedoAt(albedo, width, qx, qy)));
+					m1 += l;
+					m2 += l * l;
+				}
+			m1 /= 9.0f;
+			float* out = &dst[4 * ((size_t)y * width + x)];
+			_mm_storeu_ps(out, _mm_div_ps(texel(color, width, x, y), albedoAt(albedo, width, x, y)));
+			out[3] = std::max(m2 / 9.0f - m1 * m1, 0.0f);
+		}
+	});
+}
+
+//DENOISE_PASS 1: one a-trous iteration with taps step pixels apart
+static void atrous(const float* src, const float* position, const float* normal, const float* albedo, int width, int height,
+	const float eye[3], float heightRatio, int step, bool remodulate, float* dst, int threadCount) {
+	static const float kernel[3] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+	forRows(height, threadCount, [&](int y) {
+		for (int x = 0; x < width; ++x) {
+			size_t i = 4 * ((size_t)y * width + x);
+			__m128 center = texel(src, width, x, y);
+			const float* p = &position[i];
+			const float* n = &normal[i];
+
+			__m128 result = center;
+			if (p[3] > 0.0f) {
+				float variance = 0.0f;
+				for (int dy = -1; dy <= 1; ++dy)
+					for (int dx = -1; dx <= 1; ++dx) {
+						int qx = std::min(std::max(x + dx, 0), width - 1), qy = std::min(std::max(y + dy, 0), height - 1);
+						variance += (dx == 0 ? 0.5f : 0.25f) * (dy == 0 ? 0.5f : 0.25f) * src[4 * ((size_t)qy * width + qx) + 3];
+					}
+				float lumaScale = 1.0f / (SIGMA_LUMINANCE * std::sqrt(variance) + 1e-6f);
+				float eyeDist = std::sqrt((p[0] - eye[0]) * (p[0] - eye[0]) + (p[1] - eye[1]) * (p[1] - eye[1]) + (p[2] - eye[2]) * (p[2] - eye[2]));
+				float depthScale = 1.0f / (SIGMA_DEPTH * heightRatio * eyeDist);
+				float centerLuma = luminance(center);
+
+				__m128 sum = _mm_setzero_ps();
+				float weightSum = 0.0f;
+				for (int dy = -2; dy <= 2; ++dy)
+					for (int dx = -2; dx <= 2; ++dx) {
+						int qx = x + dx * step, qy = y + dy * step;
+						if (qx < 0 || qy < 0 || qx >= width || qy >= height)
+							continue;
+						size_t j = 4 * ((size_t)qy * width + qx);
+						const float* qp = &position[j];
+						if (qp[3] == 0.0f)
+							continue;
+						const float* qn = &normal[j];
+						__m128 q = texel(src, width, qx, qy);
+						float plane = std::fabs((qp[0] - p[0]) * n[0] + (qp[1] - p[1]) * n[1] + (qp[2] - p[2]) * n[2]) * depthScale
+							/ (std::sqrt((float)(dx * dx + dy * dy)) * step + 1e-3f);
+						float facing = std::pow(std::max(qn[0] * n[0] + qn[1] * n[1] + qn[2] * n[2], 0.0f), SIGMA_NORMAL);
+						float w = kernel[std::abs(dx)] * kernel[std::abs(dy)] * facing * std::exp(-plane - std::fabs(luminance(q) - centerLuma) * lumaScale);
+						//rgb by the weight, the variance in w by its square
+						sum = _mm_add_ps(sum, _mm_mul_ps(q, _mm_set_ps(w * w, w, w, w)));
+						weightSum += w;
+					}
+				result = _mm_div_ps(sum, _mm_set_ps(weightSum * weightSum, weightSum, weightSum, weightSum));
+			}
+
+			if (remodulate)
+				result = _mm_mul_ps(result, albedoAt(albedo, width, x, y));
+			_mm_storeu_ps(&dst[i], result);
+			if (remodulate)
+				dst[i + 3] = 1.0f;
+		}
+	});
+}
+
+void denoise(const float* color, const float* position, const float* normal, const float* albedo, int width, int height,
+	const float eye[3], float heightRatio, int iterations, float* out, int threadCount) {
+	size_t size = (size_t)width * height * 4;
+	if (iterations <= 0) {
+		std::copy(color, color + size, out);
+		return;
+	}
+	std::vector<float> a(size), b(size);
+	demodulate(color, albedo, width, height, a.data(), threadCount);
+	for (int i = 0; i < iterations; ++i) {
+		bool last = i == iterations - 1;
+		atrous(a.data(), position, normal, albedo, width, height, eye, heightRatio, 1 << i, last, last ? out : b.data(), threadCount);
+		std::swap(a, b);
+	}
+}
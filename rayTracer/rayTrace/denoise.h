@@ -0,0 +1,10 @@
+#pragma once
+
+//cpu twin of denoise.comp for headless and offline frames, on rgba float images laid out like the textures. the filter
+//is the shader's, with each pixel's four channels summed in one sse register and the rows split over threadCount threads.
+//exp and pow round differently than on the gpu, so the two agree closely rather than bit for bit
+
+//filters color, guided by the first hits: position (xyz, w 1 for a hit and 0 for sky), normal and albedo. eye and
+//heightRatio are the camera's, iterations a-trous passes 1, 2, 4.. pixels apart run after the albedo is divided out
+void denoise(const float* color, const float* position, const float* normal, const float* albedo, int width, int height,
+	const float eye[3], float heightRatio, int iterations, float* out, int threadCount = 0);
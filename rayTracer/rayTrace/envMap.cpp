@@ -0,0 +1,195 @@
+#define _USE_MATH_DEFINES
+#include "envMap.h"
+#include "shader.h"
+#include "parallel.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+
+//weights of the sampling tables, the same as luminance() in rayShader.frag
+static float luminance(const float* rgb) {
+	return 0.2126f * rgb[0] + 0.7152f * rgb[1] + 0.0722f * rgb[2];
+}
+
+static void rgbeToFloat(const unsigned char* rgbe, float* rgb) {
+	if (rgbe[3] == 0) {
+		rgb[0] = rgb[1] = rgb[2] = 0;
+		return;
+	}
+	float scale = std::ldexp(1.0f, rgbe[3] - (128 + 8));
+	for (int c = 0; c < 3; ++c)
+		rgb[c] = (rgbe[c] + 0.5f) * scale;
+}
+
+//one scanline of rgbe bytes. new style lines start with 2 2 and the width, then each channel is run length encoded on its own
+static bool readScanline(FILE* file, int width, std::vector<unsigned char>& line) {
+	unsigned char start[4];
+	if (fread(start, 1, 4, file) != 4)
+		return false;
+	if (width < 8 || width > 0x7fff || start[0] != 2 || start[1] != 2 || (start[2] & 0x80) != 0) {
+		memcpy(line.data(), start, 4);
+		return fread(line.data() + 4, 1, (size_t)(width - 1) * 4, file) == (size_t)(width - 1) * 4;
+	}
+	if (((start[2] << 8) | start[3]) != width)
+		return false;
+
+	for (int c = 0; c < 4; ++c)
+		for (int x = 0; x < width;) {
+			int count = fgetc(file);
+			if (count == EOF)
+				return false;
+			if (count > 128) {
+				//a run of one value
+				count -= 128;
+				int value = fgetc(file);
+				if (value == EOF || x + count > width)
+					return false;
+				for (; count > 0; --count, ++x)
+					line[4 * x + c] = (unsigned char)value;
+			}
+			else {
+				if (count == 0 || x + count > width)
+					return false;
+				for (; count > 0; --count, ++x) {
+					int value = fgetc(file);
+					if (value == EOF)
+						return false;
+					line[4 * x + c] = (unsigned char)value;
+				}
+			}
+		}
+	return true;
+}
+
+bool readHDR(const char filename[], std::vector<float>& rgb, int& width, int& height) {
+	FILE* file = nullptr;
+	fopen_s(&file, filename, "rb");
+	if (file == nullptr)
+		return false;
+
+	//text header up to an empty line, then the resolution line. only the usual top to bottom, left to right layout is read
+	char text[256];
+	bool radiance = fgets(text, sizeof(text), file) != nullptr && strncmp(text, "#?", 2) == 0;
+	bool rgbe = true;
+	while (radiance && fgets(text, sizeof(text), file) != nullptr && text[0] != '\n' && text[0] != '\r')
+		if (strncmp(text, "FORMAT=", 7) == 0)
+			rgbe = strncmp(text + 7, "32-bit_rle_rgbe", 15) == 0;
+	if (!radiance || !rgbe || fgets(text, sizeof(text), file) == nullptr || sscanf_s(text, "-Y %d +X %d", &height, &width) != 2 || width <= 0 || height <= 0) {
+		fclose(file);
+		return false;
+	}
+
+	rgb.resize((size_t)width * height * 3);
+	std::vector<unsigned char> line((size_t)width * 4);
+	bool ok = true;
+	for (int y = 0; y < height && ok; ++y) {
+		ok = readScanline(file, width, line);
+		for (int x = 0; x < width && ok; ++x)
+			rgbeToFloat(&line[4 * x], &rgb[3 * ((size_t)y * width + x)]);
+	}
+	fclose(file);
+	return ok;
+}
+
+double buildEnvironmentCdf(const float* rgb, int width, int height, std::vector<float>& conditional, std::vector<float>& marginal, int threadCount) {
+	conditional.resize((size_t)width * height);
+	marginal.resize(height);
+	std::vector<double> rowSums(height);
+
+	forRows(height, threadCount, [&](int y) {
+		float sinTheta = std::sin((float)M_PI * (y + 0.5f) / height);
+		float* cdf = &conditional[(size_t)y * width];
+		double sum = 0;
+		for (int x = 0; x < width; ++x) {
+			sum += luminance(&rgb[3 * ((size_t)y * width + x)]) * sinTheta;
+			cdf[x] = (float)sum;
+		}
+		rowSums[y] = sum;
+		//a black row is never picked, but keep its cdf valid
+		for (int x = 0; x < width; ++x)
+			cdf[x] = sum > 0 ? (float)(cdf[x] / sum) : (float)(x + 1) / width;
+		cdf[width - 1] = 1.0f;
+	});
+
+	double total = 0;
+	for (int y = 0; y < height; ++y) {
+		total += rowSums[y];
+		marginal[y] = (float)total;
+	}
+	for (int y = 0; y < height; ++y)
+		marginal[y] = total > 0 ? (float)(marginal[y] / total) : (float)(y + 1) / height;
+	marginal[height - 1] = 1.0f;
+	return total;
+}
+
+EnvironmentMap::EnvironmentMap() {
+	width = height = 0;
+	radianceTex = conditionalTex = marginalTex = 0;
+	pdfScale = 0;
+}
+
+EnvironmentMap::~EnvironmentMap() {
+	GLuint textures[3] = { radianceTex, conditionalTex, marginalTex };
+	if (radianceTex != 0)
+		glDeleteTextures(3, textures);
+}
+
+static GLuint createTexture(int unit, GLenum internalFormat, int width, int height, GLenum format, const float* data, GLenum filter, GLenum wrapS) {
+	GLuint tex;
+	glGenTextures(1, &tex);
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_2D, tex);
+	glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, width, height);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, GL_FLOAT, data);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapS);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	return tex;
+}
+
+bool EnvironmentMap::load(const char filename[], int threadCount) {
+	auto start = std::chrono::steady_clock::now();
+	std::vector<float> rgb;
+	if (!readHDR(filename, rgb, width, height)) {
+		printf("environment: could not read %s\n", filename);
+		return false;
+	}
+	GLint maxSize;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	if (width > maxSize || height > maxSize) {
+		printf("environment: %s is larger than the %d texel limit\n", filename, (int)maxSize);
+		return false;
+	}
+	auto read = std::chrono::steady_clock::now();
+
+	std::vector<float> conditional, marginal;
+	double total = buildEnvironmentCdf(rgb.data(), width, height, conditional, marginal, threadCount);
+	if (total <= 0) {
+		printf("environment: %s is black\n", filename);
+		return false;
+	}
+	//texel pdf is weight / total, spread over a texel's 2pi/width by pi/height of angle and divided by the sin theta already in the weight
+	pdfScale = (float)(width * (double)height / (2.0 * M_PI * M_PI * total));
+	auto built = std::chrono::steady_clock::now();
+
+	//equirectangular wraps around horizontally only
+	radianceTex = createTexture(ENV_TEXTURE_UNIT, GL_RGB32F, width, height, GL_RGB, rgb.data(), GL_LINEAR, GL_REPEAT);
+	conditionalTex = createTexture(ENV_TEXTURE_UNIT + 1, GL_R32F, width, height, GL_RED, conditional.data(), GL_NEAREST, GL_CLAMP_TO_EDGE);
+	marginalTex = createTexture(ENV_TEXTURE_UNIT + 2, GL_R32F, height, 1, GL_RED, marginal.data(), GL_NEAREST, GL_CLAMP_TO_EDGE);
+	glActiveTexture(GL_TEXTURE0);
+
+	printf("environment: %s, %dx%d, read in %.1f ms, sampling tables built in %.1f ms\n", filename, width, height,
+		std::chrono::duration<double, std::milli>(read - start).count(), std::chrono::duration<double, std::milli>(built - read).count());
+	return true;
+}
+
+void EnvironmentMap::setUniforms(const Shader& shader) const {
+	glUniform1i(shader.uniform("envMap"), ENV_TEXTURE_UNIT);
+	glUniform1i(shader.uniform("envConditional"), ENV_TEXTURE_UNIT + 1);
+	glUniform1i(shader.uniform("envMarginal"), ENV_TEXTURE_UNIT + 2);
+	glUniform1f(shader.uniform("envPdfScale"), pdfScale);
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <vector>
+#include <GL/glew.h>
+
+class Shader;
+
+//texture unit of the radiance texture, the two cdf tables follow it
+#define ENV_TEXTURE_UNIT 2
+
+//reads an rgbe radiance (.hdr) picture into rgb floats, rows top to bottom. flat and run length encoded scanlines are both read
+bool readHDR(const char filename[], std::vector<float>& rgb, int& width, int& height);
+
+//tables for picking equirectangular texels in proportion to luminance times sin theta, the solid angle a texel covers.
+//conditional holds one cdf per row over its columns, marginal the cdf over rows. rows are split over threadCount threads.
+//returns the sum of the weights, 0 for a black image
+double buildEnvironmentCdf(const float* rgb, int width, int height, std::vector<float>& conditional, std::vector<float>& marginal, int threadCount = 0);
+
+//hdr sky around the scene. the radiance and both cdf tables stay bound to their texture units for the ray shader
+class EnvironmentMap {
+public:
+	EnvironmentMap();
+	~EnvironmentMap();
+	//reads filename, builds the sampling tables and uploads everything. false, with nothing loaded, if the file cannot be used
+	bool load(const char filename[], int threadCount = 0);
+	//points the sampler uniforms of a bound shader at the texture units and sets its pdf scale
+	void setUniforms(const Shader& shader) const;
+	bool loaded() const { return radianceTex != 0; }
+
+private:
+	int width, height;
+	GLuint radianceTex, conditionalTex, marginalTex;
+	//turns a texel's luminance into the solid angle pdf of picking it
+	float pdfScale;
+};
@@ -0,0 +1,333 @@
+#include "geometryStore.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <cmath>
+#include <cfloat>
+#include <cstdint>
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+bool bakeGeometry(const Mesh& source, const char filename[], int trianglesPerCluster) {
+	if (trianglesPerCluster < 1)
+		return false;
+
+	//morton order makes runs of consecutive triangles spatially tight, so clusters are just runs
+	Mesh mesh = source;
+	reorderMorton(mesh);
+
+	int faceCount = mesh.faceCount();
+	GeometryHeader header = { { 'R', 'T', 'G', 'S' }, 1, (faceCount + trianglesPerCluster - 1) / trianglesPerCluster, trianglesPerCluster };
+	std::vector<GeometryCluster> clusters(header.clusterCount);
+	std::vector<float> tris(CLUSTER_TRI_FLOATS * (size_t)faceCount);
+
+	for (int f = 0; f < faceCount; ++f) {
+		float* tri = &tris[CLUSTER_TRI_FLOATS * (size_t)f];
+		for (int i = 0; i < 3; ++i) {
+			memcpy(tri + 3 * i, &mesh.vertices[3 * mesh.faces[3 * f + i]], 3 * sizeof(float));
+			int uv = mesh.faceUVs[3 * f + i];
+			tri[9 + 2 * i] = uv >= 0 ? mesh.uvs[2 * uv] : 0.0f;
+			tri[10 + 2 * i] = uv >= 0 ? mesh.uvs[2 * uv + 1] : 0.0f;
+		}
+	}
+
+	long long dataStart = sizeof(GeometryHeader) + sizeof(GeometryCluster) * (long long)header.clusterCount;
+	for (int c = 0; c < header.clusterCount; ++c) {
+		GeometryCluster& cluster = clusters[c];
+		int first = c * trianglesPerCluster;
+		cluster.triCount = std::min(trianglesPerCluster, faceCount - first);
+		cluster.offset = dataStart + (long long)first * CLUSTER_TRI_FLOATS * sizeof(float);
+		cluster.pad = 0;
+
+		float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (int t = first; t < first + cluster.triCount; ++t)
+			for (int i = 0; i < 9; ++i) {
+				float v = tris[CLUSTER_TRI_FLOATS * (size_t)t + i];
+				lo[i % 3] = std::min(lo[i % 3], v);
+				hi[i % 3] = std::max(hi[i % 3], v);
+			}
+		float r2 = 0;
+		for (int k = 0; k < 3; ++k) {
+			cluster.center[k] = 0.5f * (lo[k] + hi[k]);
+			r2 += 0.25f * (hi[k] - lo[k]) * (hi[k] - lo[k]);
+		}
+		cluster.radius = std::sqrt(r2);
+	}
+
+	FILE* file = nullptr;
+	fopen_s(&file, filename, "wb");
+	if (file == nullptr)
+		return false;
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	if (header.clusterCount > 0) {
+		ok = ok && fwrite(clusters.data(), sizeof(GeometryCluster), clusters.size(), file) == clusters.size();
+		ok = ok && fwrite(tris.data(), sizeof(float), tris.size(), file) == tris.size();
+	}
+	fclose(file);
+
+	printf("baked %s: %d triangles in %d clusters\n", filename, faceCount, header.clusterCount);
+	return ok;
+}
+
+GeometryStore::GeometryStore() {
+	mapped = nullptr;
+	mappedSize = 0;
+	fileHandle = nullptr;
+	mappingHandle = nullptr;
+	at = 0; slots = 0; budget = 0;
+	stopping = false;
+}
+
+GeometryStore::~GeometryStore() {
+	close();
+}
+
+void GeometryStore::mapFile(const char filename[]) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return;
+	LARGE_INTEGER size;
+	HANDLE mapping = NULL;
+	if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL) {
+		CloseHandle(file);
+		return;
+	}
+	mapped = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (mapped == nullptr) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return;
+	}
+	mappedSize = (size_t)size.QuadPart;
+	fileHandle = file;
+	mappingHandle = mapping;
+#else
+	int fd = ::open(filename, O_RDONLY);
+	if (fd < 0)
+		return;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+		::close(fd);
+		return;
+	}
+	void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (view == MAP_FAILED) {
+		::close(fd);
+		return;
+	}
+	madvise(view, (size_t)info.st_size, MADV_RANDOM);
+	mapped = (const char*)view;
+	mappedSize = (size_t)info.st_size;
+	fileHandle = (void*)(intptr_t)fd;
+#endif
+}
+
+void GeometryStore::unmapFile() {
+	if (mapped == nullptr)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(mapped);
+	CloseHandle((HANDLE)mappingHandle);
+	CloseHandle((HANDLE)fileHandle);
+#else
+	munmap((void*)mapped, mappedSize);
+	::close((int)(intptr_t)fileHandle);
+#endif
+	mapped = nullptr;
+	mappedSize = 0;
+	fileHandle = nullptr;
+	mappingHandle = nullptr;
+}
+
+bool GeometryStore::open(const char filename[], int first, int count, Hitable ref, int residentClusters) {
+	close();
+
+	mapFile(filename);
+	if (mapped == nullptr) {
+		printf("GeometryStore: could not map %s\n", filename);
+		return false;
+	}
+
+	//only the header and cluster table are read up front
+	GeometryHeader header;
+	bool valid = mappedSize >= sizeof(header);
+	if (valid) {
+		memcpy(&header, mapped, sizeof(header));
+		valid = memcmp(header.magic, "RTGS", 4) == 0 && header.version == 1 && header.clusterCount >= 0
+			&& mappedSize >= sizeof(header) + sizeof(GeometryCluster) * (size_t)header.clusterCount;
+	}
+	if (valid) {
+		clusters.resize(header.clusterCount);
+		if (header.clusterCount > 0)
+			memcpy(clusters.data(), mapped + sizeof(header), sizeof(GeometryCluster) * clusters.size());
+		for (const GeometryCluster& cluster : clusters)
+			if (cluster.offset < 0 || cluster.triCount < 0 || (size_t)cluster.offset + (size_t)cluster.triCount * CLUSTER_TRI_FLOATS * sizeof(float) > mappedSize)
+				valid = false;
+	}
+	if (!valid) {
+		printf("GeometryStore: %s is not a baked geometry file\n", filename);
+		clusters.clear();
+		unmapFile();
+		return false;
+	}
+
+	at = first;
+	slots = count;
+	refObj = ref;
+	budget = residentClusters;
+	pending.assign(clusters.size(), false);
+	placed.clear();
+
+	stopping = false;
+	worker = std::thread(&GeometryStore::workerLoop, this);
+	return true;
+}
+
+void GeometryStore::close() {
+	if (worker.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			stopping = true;
+		}
+		queueCv.notify_all();
+		worker.join();
+	}
+
+	requests.clear();
+	completed.clear();
+	resident.clear();
+	lru.clear();
+	pending.clear();
+	placed.clear();
+	clusters.clear();
+	unmapFile();
+}
+
+//copies requested clusters out of the mapping. touching the pages here is what pulls them from disk
+void GeometryStore::workerLoop() {
+	while (true) {
+		int id;
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			queueCv.wait(lock, [this]() { return stopping || !requests.empty(); });
+			if (stopping)
+				return;
+			id = requests.front();
+			requests.pop_front();
+		}
+
+		const GeometryCluster& cluster = clusters[id];
+		std::vector<float> tris((size_t)cluster.triCount * CLUSTER_TRI_FLOATS);
+		if (!tris.empty())
+			memcpy(tris.data(), mapped + cluster.offset, tris.size() * sizeof(float));
+
+		std::lock_guard<std::mutex> lock(queueMutex);
+		completed.push_back(std::make_pair(id, std::move(tris)));
+	}
+}
+
+bool GeometryStore::update(const Vector<float>& eye, Hitable* objArray) {
+	if (clusters.empty())
+		return false;
+
+	//the working set is the clusters nearest the eye
+	std::vector<std::pair<float, int>> order(clusters.size());
+	for (int c = 0; c < (int)clusters.size(); ++c) {
+		float d2 = 0;
+		for (int k = 0; k < 3; ++k)
+			d2 += (clusters[c].center[k] - eye[k]) * (clusters[c].center[k] - eye[k]);
+		order[c] = std::make_pair(std::sqrt(d2) - clusters[c].radius, c);
+	}
+	int wanted = std::min(budget, (int)order.size());
+	std::partial_sort(order.begin(), order.begin() + wanted, order.end());
+
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+
+		for (auto& done : completed) {
+			pending[done.first] = false;
+			lru.push_front(done.first);
+			Resident& entry = resident[done.first];
+			entry.lruPos = lru.begin();
+			entry.tris = std::move(done.second);
+		}
+		completed.clear();
+
+		//requests for clusters that fell out of the working set are dropped, nearest go first
+		for (int id : requests)
+			pending[id] = false;
+		requests.clear();
+		for (int i = 0; i < wanted; ++i) {
+			int id = order[i].second;
+			auto found = resident.find(id);
+			if (found != resident.end())
+				lru.splice(lru.begin(), lru, found->second.lruPos);
+			else if (!pending[id]) {
+				pending[id] = true;
+				requests.push_back(id);
+			}
+		}
+	}
+	queueCv.notify_one();
+
+	//least recently wanted clusters leave first
+	while ((int)resident.size() > budget) {
+		resident.erase(lru.back());
+		lru.pop_back();
+	}
+
+	//fill slots with resident clusters, nearest first
+	std::vector<int> nowPlaced;
+	int used = 0;
+	for (int i = 0; i < wanted; ++i) {
+		int id = order[i].second;
+		if (resident.count(id) == 0 || used + clusters[id].triCount > slots)
+			continue;
+		nowPlaced.push_back(id);
+		used += clusters[id].triCount;
+	}
+	if (nowPlaced == placed)
+		return false;
+	placed = nowPlaced;
+
+	Hitable* face = objArray + at;
+	for (int id : placed) {
+		const std::vector<float>& tris = resident[id].tris;
+		for (int t = 0; t < clusters[id].triCount; ++t, ++face) {
+			const float* tri = &tris[CLUSTER_TRI_FLOATS * (size_t)t];
+			*face = Hitable();
+			face->type = 2;
+			face->matType = refObj.matType;
+			face->texId = refObj.texId;
+			face->fuzz = refObj.fuzz;
+			face->refIdx = refObj.refIdx;
+			memcpy(face->A, tri, 3 * sizeof(float));
+			memcpy(face->B, tri + 3, 3 * sizeof(float));
+			memcpy(face->C, tri + 6, 3 * sizeof(float));
+			memcpy(face->uvA, tri + 9, 2 * sizeof(float));
+			memcpy(face->uvB, tri + 11, 2 * sizeof(float));
+			memcpy(face->uvC, tri + 13, 2 * sizeof(float));
+			for (int i = 0; i < 3; ++i) {
+				face->color[i] = refObj.color[i];
+				face->emission[i] = refObj.emission[i];
+			}
+		}
+	}
+	for (; face < objArray + at + slots; ++face)
+		*face = Hitable();
+
+	return true;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <vector>
+#include <list>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "mesh.h"
+
+//cluster file layout: header, cluster table, then every cluster's triangles back to back
+struct GeometryHeader {
+	char magic[4]; //"RTGS"
+	int version;
+	int clusterCount;
+	int trianglesPerCluster;
+};
+
+struct GeometryCluster {
+	float center[3];
+	float radius;
+	long long offset; //bytes from the start of the file
+	int triCount;
+	int pad;
+};
+
+//floats per stored triangle: A, B, C, uvA, uvB, uvC
+#define CLUSTER_TRI_FLOATS 15
+
+//splits a mesh into spatially coherent clusters and writes them to a file that can be streamed with GeometryStore
+bool bakeGeometry(const Mesh& mesh, const char filename[], int trianglesPerCluster = 8);
+
+//pages clusters of a baked geometry file in and out of a run of world slots, nearest to the camera first.
+//reads happen on a worker thread so the render thread never waits on disk
+class GeometryStore {
+public:
+	GeometryStore();
+	~GeometryStore();
+	bool open(const char filename[], int at, int slots, Hitable refObj, int residentClusters = 16);
+	void close();
+	//requests the clusters nearest the eye and writes the resident ones into objArray. returns true if objArray changed
+	bool update(const Vector<float>& eye, Hitable* objArray);
+
+	int clusterCount() const { return (int)clusters.size(); }
+	int residentCount() const { return (int)resident.size(); }
+
+private:
+	void workerLoop();
+	void mapFile(const char filename[]);
+	void unmapFile();
+
+	//file mapping
+	const char* mapped;
+	size_t mappedSize;
+	void* fileHandle;
+	void* mappingHandle;
+
+	std::vector<GeometryCluster> clusters;
+	int at, slots;
+	Hitable refObj;
+	int budget;
+
+	//resident clusters, most recently used at the front
+	std::list<int> lru;
+	struct Resident {
+		std::list<int>::iterator lruPos;
+		std::vector<float> tris;
+	};
+	std::unordered_map<int, Resident> resident;
+	std::vector<bool> pending;
+	std::vector<int> placed;
+
+	//worker thread
+	std::thread worker;
+	std::mutex queueMutex;
+	std::condition_variable queueCv;
+	std::deque<int> requests;
+	std::vector<std::pair<int, std::vector<float>>> completed;
+	bool stopping;
+};
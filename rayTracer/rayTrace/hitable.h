@@ -0,0 +1,108 @@
+#pragma once
+#include "vector.h"
+
+//macros
+#define MAX_OBJ 64
+//lights next event estimation can sample, a multiple of 4
+#define MAX_LIGHTS 16
+
+//hitable object struct
+struct Hitable {
+	//commented members are positioned to facillitate readability. Their actual declarations are grouped for padding purposes.
+	//int type; //-1 = none; 0 = sphere; 1 = plane; 2 = triangle; 3 = quad; 100 = BVH box
+	//sphere properties
+	float center[4];
+	//float radius;
+	//plane properties
+	float normal[4];
+	float point[4];
+	//triangle properties, a quad is the parallelogram with corner A and edges to B and C
+	float A[4];
+	float B[4];
+	float C[4];
+
+	//material properties
+	//int matType; //-1 = none; 1 = diffuse; 2 = reflective; 3 = dieletric
+	float color[4];
+	//light properties, radiance given off from both sides. [3] is set by the renderer when the object is in the light list
+	float emission[4];
+	//reflective properties
+	//float fuzz;
+	//refractive properties
+	//float refIdx;
+
+	//texture properties
+	//float uvA[2];
+	//float uvB[2];
+	//float uvC[2];
+	//int texId;
+	
+	//group above commented members for padding purposes
+	int type; //-1 = none; 0 = sphere; 1 = plane; 2 = triangle; 3 = quad
+	float radius;
+	int matType; //-1 = none; 1 = diffuse; 2 = reflective; 3 = diffuse&reflective; 4 = dieletric
+	float fuzz;
+	float refIdx;
+	int texId;
+	float uvA[2];
+	float uvB[2];
+	float uvC[2];
+
+	Hitable() { type = -1; texId = -1; emission[0] = emission[1] = emission[2] = emission[3] = 0; }
+};
+
+//hitable constructors
+template <typename component>
+Hitable Sphere(Vector<component> c, float r) {
+	Hitable sphere;
+	sphere.type = 0;
+	sphere.texId = -1;
+	sphere.radius = r;
+	sphere.matType = 1;
+	for (int i = 0; i < 3; ++i) {
+		sphere.center[i] = c[i];
+		sphere.color[i] = 0.5;
+	}
+	
+	return sphere;
+}
+
+template <typename component>
+Hitable Plane(Vector<component> p, Vector<component> n) {
+	Hitable plane;
+	plane.type = 1;
+	plane.texId = -1;
+	plane.matType = 1;
+	for (int i = 0; i < 3; ++i) {
+		plane.point[i] = p[i];
+		plane.normal[i] = n[i];
+		plane.color[i] = 0.5;
+	}
+
+	return plane;
+}
+
+template <typename component>
+Hitable Triangle(Vector<component> a, Vector<component> b, Vector<component> c) {
+	Hitable tri;
+	tri.type = 2;
+	tri.texId = -1;
+	tri.matType = 1;
+	for (int i = 0; i < 3; ++i) {
+		tri.A[i] = a[i];
+		tri.B[i] = b[i];
+		tri.C[i] = c[i];
+		tri.color[i] = 0.5;
+	}
+
+	return tri;
+}
+
+//parallelogram with corner a and edges a to b and a to c
+template <typename component>
+Hitable Quad(Vector<component> a, Vector<component> b, Vector<component> c) {
+	Hitable quad = Triangle(a, b, c);
+	quad.type = 3;
+
+	return quad;
+}
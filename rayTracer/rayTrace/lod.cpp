@@ -0,0 +1,338 @@
+#include "lod.h"
+
+#include <stdio.h>
+#include <cmath>
+#include <cfloat>
+#include <climits>
+#include <algorithm>
+#include <queue>
+#include <map>
+#include <unordered_map>
+#include <string>
+#include <mutex>
+#include <future>
+
+//triangles spent per covered pixel when picking a level
+#define PIXELS_PER_TRIANGLE 16.0f
+//how strongly open borders resist being collapsed
+#define BOUNDARY_WEIGHT 1000.0
+
+//symmetric 4x4 error quadric, upper triangle stored row by row
+struct Quadric {
+	double q[10];
+
+	Quadric() { for (int i = 0; i < 10; ++i) q[i] = 0; }
+	//quadric of the plane ax + by + cz + d = 0, scaled by w
+	Quadric(double a, double b, double c, double d, double w) {
+		q[0] = a * a * w; q[1] = a * b * w; q[2] = a * c * w; q[3] = a * d * w;
+		q[4] = b * b * w; q[5] = b * c * w; q[6] = b * d * w;
+		q[7] = c * c * w; q[8] = c * d * w;
+		q[9] = d * d * w;
+	}
+
+	void operator += (const Quadric& b) { for (int i = 0; i < 10; ++i) q[i] += b.q[i]; }
+
+	double error(const double v[3]) const {
+		double x = v[0], y = v[1], z = v[2];
+		return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+			+ q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+			+ q[7] * z * z + 2 * q[8] * z
+			+ q[9];
+	}
+
+	//position minimizing the error, false if the system is singular
+	bool optimum(double v[3]) const {
+		double a = q[0], b = q[1], c = q[2], d = q[4], e = q[5], f = q[7];
+		double det = a * (d * f - e * e) - b * (b * f - e * c) + c * (b * e - d * c);
+		if (std::fabs(det) < 1e-12)
+			return false;
+		double r[3] = { -q[3], -q[6], -q[8] };
+		v[0] = (r[0] * (d * f - e * e) - b * (r[1] * f - e * r[2]) + c * (r[1] * e - d * r[2])) / det;
+		v[1] = (a * (r[1] * f - e * r[2]) - r[0] * (b * f - e * c) + c * (b * r[2] - r[1] * c)) / det;
+		v[2] = (a * (d * r[2] - r[1] * e) - b * (b * r[2] - r[1] * c) + r[0] * (b * e - d * c)) / det;
+		return true;
+	}
+};
+
+//candidate edge collapse. stamps detect entries made stale by later collapses
+struct Collapse {
+	double cost;
+	int v0, v1;
+	int stamp0, stamp1;
+	double pos[3];
+
+	bool operator > (const Collapse& b) const { return cost > b.cost; }
+};
+
+static void faceNormal(const double a[3], const double b[3], const double c[3], double n[3]) {
+	double e0[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+	double e1[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+	n[0] = e0[1] * e1[2] - e0[2] * e1[1];
+	n[1] = e0[2] * e1[0] - e0[0] * e1[2];
+	n[2] = e0[0] * e1[1] - e0[1] * e1[0];
+}
+
+void simplifyMesh(const Mesh& src, Mesh& dst, int targetFaces) {
+	int vertexCount = src.vertexCount();
+	int faceCount = src.faceCount();
+
+	std::vector<double> pos(3 * vertexCount);
+	for (int i = 0; i < 3 * vertexCount; ++i)
+		pos[i] = src.vertices[i];
+	std::vector<int> faces = src.faces;
+	std::vector<bool> faceAlive(faceCount, true);
+	std::vector<bool> vertAlive(vertexCount, true);
+	std::vector<int> stamps(vertexCount, 0);
+	std::vector<std::vector<int>> vertFaces(vertexCount);
+	std::vector<Quadric> quadrics(vertexCount);
+
+	//plane quadrics of every face, weighted by area
+	std::unordered_map<long long, int> edgeUse;
+	for (int f = 0; f < faceCount; ++f) {
+		const int* v = &faces[3 * f];
+		double n[3];
+		faceNormal(&pos[3 * v[0]], &pos[3 * v[1]], &pos[3 * v[2]], n);
+		double len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (len > 0) {
+			Quadric q(n[0] / len, n[1] / len, n[2] / len, -(n[0] * pos[3 * v[0]] + n[1] * pos[3 * v[0] + 1] + n[2] * pos[3 * v[0] + 2]) / len, 0.5 * len);
+			for (int i = 0; i < 3; ++i)
+				quadrics[v[i]] += q;
+		}
+		for (int i = 0; i < 3; ++i) {
+			vertFaces[v[i]].push_back(f);
+			int a = std::min(v[i], v[(i + 1) % 3]), b = std::max(v[i], v[(i + 1) % 3]);
+			++edgeUse[((long long)a << 32) | b];
+		}
+	}
+
+	//border edges get a perpendicular plane so the outline survives
+	for (int f = 0; f < faceCount; ++f) {
+		const int* v = &faces[3 * f];
+		double n[3];
+		faceNormal(&pos[3 * v[0]], &pos[3 * v[1]], &pos[3 * v[2]], n);
+		for (int i = 0; i < 3; ++i) {
+			int a = v[i], b = v[(i + 1) % 3];
+			if (edgeUse[((long long)std::min(a, b) << 32) | std::max(a, b)] != 1)
+				continue;
+			double e[3] = { pos[3 * b] - pos[3 * a], pos[3 * b + 1] - pos[3 * a + 1], pos[3 * b + 2] - pos[3 * a + 2] };
+			double p[3] = { e[1] * n[2] - e[2] * n[1], e[2] * n[0] - e[0] * n[2], e[0] * n[1] - e[1] * n[0] };
+			double len = std::sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+			if (len == 0)
+				continue;
+			for (int k = 0; k < 3; ++k)
+				p[k] /= len;
+			double d = -(p[0] * pos[3 * a] + p[1] * pos[3 * a + 1] + p[2] * pos[3 * a + 2]);
+			Quadric q(p[0], p[1], p[2], d, BOUNDARY_WEIGHT * (e[0] * e[0] + e[1] * e[1] + e[2] * e[2]));
+			quadrics[a] += q;
+			quadrics[b] += q;
+		}
+	}
+
+	auto makeCollapse = [&](int v0, int v1) {
+		Collapse c;
+		c.v0 = v0; c.v1 = v1;
+		c.stamp0 = stamps[v0]; c.stamp1 = stamps[v1];
+		Quadric q = quadrics[v0];
+		q += quadrics[v1];
+		if (q.optimum(c.pos)) {
+			c.cost = q.error(c.pos);
+		}
+		else {
+			//fall back to the best of the endpoints and midpoint
+			c.cost = DBL_MAX;
+			for (int t = 0; t < 3; ++t) {
+				double p[3];
+				for (int k = 0; k < 3; ++k)
+					p[k] = t == 0 ? pos[3 * v0 + k] : t == 1 ? pos[3 * v1 + k] : 0.5 * (pos[3 * v0 + k] + pos[3 * v1 + k]);
+				double err = q.error(p);
+				if (err < c.cost) {
+					c.cost = err;
+					for (int k = 0; k < 3; ++k)
+						c.pos[k] = p[k];
+				}
+			}
+		}
+		return c;
+	};
+
+	std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap;
+	for (auto& edge : edgeUse)
+		heap.push(makeCollapse((int)(edge.first >> 32), (int)(edge.first & 0xFFFFFFFF)));
+
+	//moving v to p must not flip any face around it that survives the collapse
+	auto flips = [&](int v, int other, const double p[3]) {
+		for (int f : vertFaces[v]) {
+			if (!faceAlive[f])
+				continue;
+			const int* fv = &faces[3 * f];
+			if (fv[0] == other || fv[1] == other || fv[2] == other)
+				continue;
+			const double* corners[3];
+			const double* moved[3];
+			for (int i = 0; i < 3; ++i) {
+				corners[i] = &pos[3 * fv[i]];
+				moved[i] = fv[i] == v ? p : corners[i];
+			}
+			double before[3], after[3];
+			faceNormal(corners[0], corners[1], corners[2], before);
+			faceNormal(moved[0], moved[1], moved[2], after);
+			if (before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0)
+				return true;
+		}
+		return false;
+	};
+
+	int liveFaces = faceCount;
+	while (liveFaces > targetFaces && !heap.empty()) {
+		Collapse c = heap.top();
+		heap.pop();
+		if (!vertAlive[c.v0] || !vertAlive[c.v1] || stamps[c.v0] != c.stamp0 || stamps[c.v1] != c.stamp1)
+			continue;
+		if (flips(c.v0, c.v1, c.pos) || flips(c.v1, c.v0, c.pos))
+			continue;
+
+		//merge v1 into v0
+		int v0 = c.v0, v1 = c.v1;
+		for (int k = 0; k < 3; ++k)
+			pos[3 * v0 + k] = c.pos[k];
+		quadrics[v0] += quadrics[v1];
+		vertAlive[v1] = false;
+		++stamps[v0];
+
+		for (int f : vertFaces[v1]) {
+			if (!faceAlive[f])
+				continue;
+			int* fv = &faces[3 * f];
+			bool shared = fv[0] == v0 || fv[1] == v0 || fv[2] == v0;
+			if (shared) {
+				faceAlive[f] = false;
+				--liveFaces;
+				continue;
+			}
+			for (int i = 0; i < 3; ++i)
+				if (fv[i] == v1)
+					fv[i] = v0;
+			vertFaces[v0].push_back(f);
+		}
+		vertFaces[v1].clear();
+
+		//drop dead faces and requeue every edge leaving v0
+		std::vector<int>& around = vertFaces[v0];
+		around.erase(std::remove_if(around.begin(), around.end(), [&](int f) { return !faceAlive[f]; }), around.end());
+		for (int f : around)
+			for (int i = 0; i < 3; ++i) {
+				int n = faces[3 * f + i];
+				if (n != v0)
+					heap.push(makeCollapse(v0, n));
+			}
+	}
+
+	//gather survivors, reorderMorton drops the unused vertices
+	dst.vertices.resize(3 * vertexCount);
+	for (int i = 0; i < 3 * vertexCount; ++i)
+		dst.vertices[i] = (float)pos[i];
+	dst.uvs = src.uvs;
+	dst.faces.clear();
+	dst.faceUVs.clear();
+	for (int f = 0; f < faceCount; ++f) {
+		if (!faceAlive[f])
+			continue;
+		for (int i = 0; i < 3; ++i) {
+			dst.faces.push_back(faces[3 * f + i]);
+			dst.faceUVs.push_back(src.faceUVs[3 * f + i]);
+		}
+	}
+	reorderMorton(dst);
+}
+
+//lod chains by filename and level count
+static std::map<std::string, LodChain> lodCache;
+static std::mutex lodCacheMutex;
+
+const LodChain* loadLodChain(const char filename[], int levelCount) {
+	std::string key = std::string(filename) + "#" + std::to_string(levelCount);
+	std::lock_guard<std::mutex> lock(lodCacheMutex);
+
+	auto found = lodCache.find(key);
+	if (found != lodCache.end())
+		return &found->second;
+
+	LodChain chain;
+	chain.levels.resize(levelCount > 0 ? levelCount : 1);
+	Mesh& full = chain.levels[0];
+	if (!loadObjMesh(filename, full))
+		return nullptr;
+	optimizeMesh(full);
+
+	//bounding sphere around the box center
+	float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (int v = 0; v < full.vertexCount(); ++v)
+		for (int k = 0; k < 3; ++k) {
+			lo[k] = std::min(lo[k], full.vertices[3 * v + k]);
+			hi[k] = std::max(hi[k], full.vertices[3 * v + k]);
+		}
+	chain.radius = 0;
+	for (int k = 0; k < 3; ++k)
+		chain.center[k] = full.vertexCount() > 0 ? 0.5f * (lo[k] + hi[k]) : 0.0f;
+	for (int v = 0; v < full.vertexCount(); ++v) {
+		float d2 = 0;
+		for (int k = 0; k < 3; ++k)
+			d2 += (full.vertices[3 * v + k] - chain.center[k]) * (full.vertices[3 * v + k] - chain.center[k]);
+		chain.radius = std::max(chain.radius, std::sqrt(d2));
+	}
+
+	//every level simplifies the full mesh independently, so they can all run at once
+	std::vector<std::future<void>> jobs;
+	for (int l = 1; l < (int)chain.levels.size(); ++l)
+		jobs.push_back(std::async(std::launch::async, [&chain, l]() {
+			simplifyMesh(chain.levels[0], chain.levels[l], chain.levels[0].faceCount() >> l);
+		}));
+	for (auto& job : jobs)
+		job.get();
+
+	printf("lod chain %s:", filename);
+	for (const Mesh& level : chain.levels)
+		printf(" %d", level.faceCount());
+	printf(" triangles\n");
+
+	return &(lodCache[key] = std::move(chain));
+}
+
+int selectLod(const MeshInstance& instance, const Vector<float>& eye, float heightRatio) {
+	const LodChain& chain = *instance.chain;
+	int levelCount = (int)chain.levels.size();
+
+	float d2 = 0;
+	for (int k = 0; k < 3; ++k)
+		d2 += (chain.center[k] - eye[k]) * (chain.center[k] - eye[k]);
+	float dist = std::sqrt(d2);
+
+	//heightRatio is the size of a pixel one unit in front of the eye
+	int desired = INT_MAX;
+	if (dist > chain.radius) {
+		float pixelRadius = chain.radius / (dist * heightRatio);
+		float coverage = 3.14159265f * pixelRadius * pixelRadius;
+		desired = (int)std::min(coverage / PIXELS_PER_TRIANGLE, (float)INT_MAX);
+	}
+
+	//coarsest level that still has enough triangles, and that fits the reserved slots
+	int level = 0;
+	while (level + 1 < levelCount && (chain.levels[level + 1].faceCount() >= desired || chain.levels[level].faceCount() > instance.slots))
+		++level;
+	return level;
+}
+
+bool updateLod(MeshInstance& instance, Hitable* objArray, const Vector<float>& eye, float heightRatio) {
+	if (instance.chain == nullptr)
+		return false;
+
+	int level = selectLod(instance, eye, heightRatio);
+	if (level == instance.level)
+		return false;
+
+	int written = meshToHitables(instance.chain->levels[level], objArray, instance.at, instance.at + instance.slots, instance.refObj);
+	for (int i = instance.at + written; i < instance.at + instance.slots; ++i)
+		objArray[i] = Hitable();
+	instance.level = level;
+	return true;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <vector>
+#include "mesh.h"
+
+//progressively simpler versions of a mesh, level 0 is the full mesh
+struct LodChain {
+	std::vector<Mesh> levels;
+	//bounding sphere of level 0
+	float center[3];
+	float radius;
+};
+
+//a lod chain placed in the world array
+struct MeshInstance {
+	const LodChain* chain;
+	int at; //first world slot
+	int slots; //world slots reserved for this instance
+	Hitable refObj;
+	int level; //level currently written to the world, -1 = none
+
+	MeshInstance(const LodChain* c, int first, int count, Hitable ref) : chain(c), at(first), slots(count), refObj(ref) { level = -1; }
+};
+
+//quadric error metric simplification down to at most targetFaces triangles
+void simplifyMesh(const Mesh& src, Mesh& dst, int targetFaces);
+
+//loads an .obj and builds its lod chain, each level in parallel with about half the triangles of the last.
+//chains are cached by filename so repeated loads are free
+const LodChain* loadLodChain(const char filename[], int levelCount = 4);
+
+//picks a level from the projected size of the instance's bounding sphere
+int selectLod(const MeshInstance& instance, const Vector<float>& eye, float heightRatio);
+//writes the selected level into objArray if it changed, returns true if it did
+bool updateLod(MeshInstance& instance, Hitable* objArray, const Vector<float>& eye, float heightRatio);
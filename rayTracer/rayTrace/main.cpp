@@ -7,18 +7,41 @@
 #include <gl/freeglut.h>
 #include <cmath>
 #include <stdio.h>
-#include <soil.h>
+#include <string.h>
+#include <string>
+#include <map>
 
 #include "shader.h"
 #include "vector.h"
 #include "matrix.h"
 #include "quaternion.h"
-
-//macros
-#define MAX_OBJ 64
-
-//shaders
-Shader rayShader;
+#include "hitable.h"
+#include "mesh.h"
+#include "lod.h"
+#include "geometryStore.h"
+#include "textureLoader.h"
+#include "blockCompress.h"
+#include "uniformRing.h"
+#include "sobol.h"
+#include "envMap.h"
+#include "resolution.h"
+#include "upscale.h"
+#include "denoise.h"
+
+//shaders, the ray shader is compiled once per set of scene features
+std::map<std::string, Shader*> rayVariants;
+Shader* rayShader = nullptr;
+//shows the accumulated image
+Shader presentShader;
+//the two passes of upscale.comp, run when the render size is below the window's
+Shader easuShader, rcasShader;
+//resolve of temporal accumulation, blends each frame into the reprojected history
+Shader temporalShader;
+//the two passes of denoise.comp, dividing out the albedo and one a-trous iteration
+Shader denoiseShader, atrousShader;
+
+//textures
+TextureLoader textureLoader;
 
 //state variables
 int width = 1000, height = 500;
@@ -27,6 +50,79 @@ Vector<float> eyePos = { 0,0,5 };
 Matrix<float> viewRotMat = { {1,0,0} , {0,1,0} , {0,0,1} };
 float heightRatio = tan(M_PI*(0.5*FOV) / 180.0)/height;
 
+int samples = 2;
+int maxBounces = 25;
+float epsilon = 0.00005f;
+//bounces before russian roulette may end a path (0 = off, r toggles), and the throughput below which paths just stop (0 = off)
+int rouletteDepth = 3;
+float throughputCutoff = 0.0f;
+//count bounces per path for the timing report, toggled with p
+bool pathStats = false;
+GLuint statsBuffer;
+int stats_binding = 3;
+//owen scrambled sobol points for jitter and bounces instead of independent random numbers, toggled with l
+bool lowDiscrepancy = true;
+uint32_t sobolDirections[SOBOL_BITS][SOBOL_DIMS];
+//hdr sky given with -env, the gradient is used without one
+EnvironmentMap environment;
+const char* environmentFile = nullptr;
+
+//run rayShader as a compute shader over tileSize x tileSize tiles instead of drawing it on a quad, toggled with c
+bool computePath = false;
+int tileSize = 8;
+
+//running mean of every frame since the camera or scene last changed, written by both paths
+GLuint accumTex = 0;
+int accumFrames = 0;
+//stop rendering tiles whose pixels have converged, toggled with v. momentTex holds the mean squared luminance per pixel,
+//tileMaskTex the last frame each tile still needed samples
+bool adaptiveSampling = false;
+int adaptiveMinFrames = 16;
+float adaptiveThreshold = 0.01f;
+GLuint momentTex = 0, tileMaskTex = 0;
+//the ray pass renders renderWidth x renderHeight, the largest scale given by -scale min max. with dynamic
+//resolution, toggled with z, the size follows the gpu time to hold targetFPS within both scales
+bool dynamicResolution = false;
+ResolutionController resolution;
+float minRenderScale = 0.5f, maxRenderScale = 1.0f;
+int renderWidth = width, renderHeight = height;
+bool renderScaleChanged = false;
+//a smaller render goes through easu and rcas into upscaledTex, at window size, instead of being stretched bilinearly.
+//u toggles it, and the first frame after turning it on is compared with the cpu reference in upscale.cpp
+bool upscaler = true;
+bool checkUpscaler = false;
+float rcasStops = 1.0f;
+GLuint easuTex = 0, upscaledTex = 0;
+//temporal accumulation, toggled with t, keeps the average while the camera moves. the ray pass writes each frame to
+//frameTex with the position and normal of its first hits, temporal.comp blends it into historyTex, last frame's
+//accumTex, reprojected with [1] of the geometry targets. accumTex and historyTex and the [0] and [1] targets swap
+//every frame. adaptive sampling is off meanwhile, a skipped tile would leave a stale frame behind
+bool temporal = false;
+GLuint frameTex = 0, historyTex = 0, positionTex[2] = { 0, 0 }, normalTex[2] = { 0, 0 };
+//checkerboard rendering, toggled with k, traces every other pixel of each row, alternating between frames, and lets
+//temporal.comp fill in the rest from their history and the traced neighbours, so it turns temporal accumulation on.
+//the first frame after turning it on, and one every report while path stats are on, is also traced in full to see
+//how far the reconstruction is from it
+bool checkerboard = false;
+bool compareCheckerboard = false;
+//edge avoiding a-trous denoiser over the accumulated image, toggled with n. it is guided by the [0] geometry targets
+//and albedoTex, which the ray pass then fills too, filters the lighting back and forth between the two denoiseTex and
+//leaves the result in denoisedTex. the first frame after turning it on is compared with the cpu filter in denoise.cpp
+bool denoiser = false;
+bool checkDenoiser = false;
+int denoiseIterations = 5;
+//once the average holds this many frames it is about as clean on its own, and sharper, so the denoiser steps aside
+int denoiseFrames = 40;
+GLuint albedoTex = 0, denoiseTex[2] = { 0, 0 }, denoisedTex = 0;
+float lastCamera[12];
+
+//gpu time of the ray pass, averaged over a few seconds so the two paths can be compared
+GLuint timerQueries[RING_REGIONS];
+//whether the frame behind each query traced every pixel, converged tiles would make it look cheaper than it is
+bool queryFullFrame[RING_REGIONS];
+double gpuTimeMs = 0, gpuTimeStart = 0;
+int gpuTimeFrames = 0;
+
 int targetFPS = 24;
 double lastTime;
 double dt;
@@ -38,227 +134,177 @@ float moveSpeed = 3.0;
 void display(void);
 void update(void);
 void reshape(int w, int h);
+//recreates the render targets at the window size times the render scale
+void resizeTargets();
 void onMouseMoved(int x, int y);
 void OnKeyboardDown(unsigned char key, int x, int y);
 void OnKeyboardUp(unsigned char key, int x, int y);
 
-//hitable object struct
-struct Hitable {
-	//commented members are positioned to facillitate readability. Their actual declarations are grouped for padding purposes.
-	//int type; //-1 = none; 0 = sphere; 1 = plane; 2 = triangle; 100 = BVH box
-	//sphere properties
-	float center[4];
-	//float radius;
-	//plane properties
-	float normal[4];
-	float point[4];
-	//triangle properties
-	float A[4];
-	float B[4];
-	float C[4];
-
-	//material properties
-	//int matType; //-1 = none; 1 = diffuse; 2 = reflective; 3 = dieletric
-	float color[4];
-	//reflective properties
-	//float fuzz;
-	//refractive properties
-	//float refIdx;
-
-	//texture properties
-	//float uvA[2];
-	//float uvB[2];
-	//float uvC[2];
-	//int texId;
-	
-	//group above commented members for padding purposes
-	int type; //-1 = none; 0 = sphere; 1 = plane; 2 = triangle
-	float radius;
-	int matType; //-1 = none; 1 = diffuse; 2 = reflective; 3 = diffuse&reflective; 4 = dieletric
-	float fuzz;
-	float refIdx;
-	int texId;
-	float uvA[2];
-	float uvB[2];
-	float uvC[2];
-
-	Hitable() { type = -1; texId = -1; }
+//prepare the world to be rendered
+Hitable world[MAX_OBJ];
+GLuint uboObjs;
+//meshes whose level of detail follows the camera
+std::vector<MeshInstance> meshInstances;
+//geometry too big for memory, paged in around the camera
+GeometryStore geometryStore;
+int binding_index = 1;
+
+//mirrors lightBlock in rayShader.frag, the emissive objects next event estimation samples
+struct LightBlock {
+	int count;
+	int pad[3];
+	int ids[MAX_LIGHTS];
 };
-
-//hitable constructors
-template <typename component>
-Hitable Sphere(Vector<component> c, float r) {
-	Hitable sphere;
-	sphere.type = 0;
-	sphere.texId = -1;
-	sphere.radius = r;
-	sphere.matType = 1;
-	for (int i = 0; i < 3; ++i) {
-		sphere.center[i] = c[i];
-		sphere.color[i] = 0.5;
-	}
-	
-	return sphere;
+GLuint uboLights;
+int light_binding = 4;
+
+//mirrors cameraBlock in rayShader.frag, std140 pads every mat3 column and vec3 to four floats
+struct CameraBlock {
+	float viewRot[12];
+	float eye[3];
+	float heightRatio;
+	float resolution[2];
+	float resInv[2];
+	int frame;
+	int accumFrames;
+	int pad[2];
+	float prevViewRot[12];
+	float prevEye[3];
+	int pad2;
+};
+UniformRing cameraRing;
+int camera_binding = 2;
+int frameIndex = 0;
+
+//the accumulated image is bound to unit 1, a reloaded program starts out reading unit 0 again
+void setupPresentShader() {
+	presentShader.bind();
+	glUniform1i(presentShader.uniform("image"), 1);
+	presentShader.unbind();
 }
 
-template <typename component>
-Hitable Plane(Vector<component> p, Vector<component> n) {
-	Hitable plane;
-	plane.type = 1;
-	plane.texId = -1;
-	plane.matType = 1;
-	for (int i = 0; i < 3; ++i) {
-		plane.point[i] = p[i];
-		plane.normal[i] = n[i];
-		plane.color[i] = 0.5;
+//defines specializing the ray shader to world, primitive and material paths it never needs are compiled out
+std::string sceneDefines() {
+	bool sphere = false, plane = false, triangle = false, quad = false, texture = false, diffuse = false, reflective = false, dielectric = false, lights = false;
+	for (const Hitable& obj : world) {
+		sphere |= obj.type == 0;
+		plane |= obj.type == 1;
+		triangle |= obj.type == 2;
+		quad |= obj.type == 3;
+		texture |= obj.type == 2 && obj.texId != -1;
+		diffuse |= obj.type != -1 && obj.matType == 1;
+		reflective |= obj.type != -1 && obj.matType == 2;
+		dielectric |= obj.type != -1 && obj.matType == 3;
+		lights |= obj.type != -1 && (obj.emission[0] > 0 || obj.emission[1] > 0 || obj.emission[2] > 0);
 	}
 
-	return plane;
+	char defines[1024];
+	snprintf(defines, sizeof(defines),
+		"#define SAMPLES %d\n#define MAX_BOUNCES %d\n#define MAX_OBJ %d\n#define EPSILON %g\n"
+		"#define HAS_SPHERE %d\n#define HAS_PLANE %d\n#define HAS_TRIANGLE %d\n#define HAS_QUAD %d\n#define HAS_TEXTURE %d\n"
+		"#define HAS_DIFFUSE %d\n#define HAS_REFLECTIVE %d\n#define HAS_DIELECTRIC %d\n#define HAS_LIGHTS %d\n"
+		"#define ROULETTE_DEPTH %d\n#define THROUGHPUT_CUTOFF %f\n#define PATH_STATS %d\n#define LOW_DISCREPANCY %d\n#define HAS_ENV_MAP %d\n"
+		"#define TILE_SIZE %d\n#define ADAPTIVE_SAMPLING %d\n#define ADAPTIVE_MIN_FRAMES %d\n#define ADAPTIVE_THRESHOLD %f\n#define TEMPORAL %d\n#define DENOISE %d\n"
+		"#define CHECKERBOARD %d\n",
+		samples, maxBounces, MAX_OBJ, epsilon, sphere, plane, triangle, quad, texture, diffuse, reflective, dielectric, lights,
+		rouletteDepth, throughputCutoff, pathStats, lowDiscrepancy, environment.loaded(),
+		tileSize, adaptiveSampling, adaptiveMinFrames, adaptiveThreshold, temporal, denoiser, checkerboard);
+	if (computePath)
+		return std::string(defines) + "#define COMPUTE_PATH 1\n";
+	return defines;
 }
 
-template <typename component>
-Hitable Triangle(Vector<component> a, Vector<component> b, Vector<component> c) {
-	Hitable tri;
-	tri.type = 2;
-	tri.texId = -1;
-	tri.matType = 1;
-	for (int i = 0; i < 3; ++i) {
-		tri.A[i] = a[i];
-		tri.B[i] = b[i];
-		tri.C[i] = c[i];
-		tri.color[i] = 0.5;
+//lists the emissive spheres, triangles and quads for next event estimation and marks them in world.
+//planes are never listed, they can only be found by bounces
+void updateLights() {
+	LightBlock lights = {};
+	for (int i = 0; i < MAX_OBJ; ++i) {
+		Hitable& obj = world[i];
+		bool emissive = obj.type != -1 && (obj.emission[0] > 0 || obj.emission[1] > 0 || obj.emission[2] > 0);
+		bool listed = emissive && obj.type != 1 && lights.count < MAX_LIGHTS;
+		if (emissive && obj.type != 1 && !listed)
+			printf("light %d skipped, only %d lights can be sampled\n", i, MAX_LIGHTS);
+		obj.emission[3] = listed ? 1.0f : 0.0f;
+		if (listed)
+			lights.ids[lights.count++] = i;
 	}
 
-	return tri;
+	glBindBuffer(GL_UNIFORM_BUFFER, uboLights);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(lights), &lights);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
-//model I/O
-void loadObj(const char filename[], Hitable* objArray, int at, Hitable refObj) {
-	const unsigned int BUFFER_SIZE = 1024;
-
-	FILE* p_obj;
-	char str[BUFFER_SIZE];
+//state that lives in the program object, needed again whenever a variant is built or reloaded
+void setupRayShader(Shader* shader) {
+	shader->bind();
+	glUniformBlockBinding(shader->id(), shader->block("worldBlock"), binding_index);
+	glUniformBlockBinding(shader->id(), shader->block("cameraBlock"), camera_binding);
+	glUniformBlockBinding(shader->id(), shader->block("lightBlock"), light_binding);
+	textureLoader.setUniforms(shader->id());
+	glUniform4uiv(shader->uniform("sobolDirections"), SOBOL_BITS, &sobolDirections[0][0]);
+	if (environment.loaded())
+		environment.setUniforms(*shader);
+	shader->unbind();
+}
 
-	fopen_s(&p_obj, filename, "r");
-	if (p_obj == nullptr)
+//switches to the ray shader variant matching world, building it the first time that feature set appears
+void selectRayShader() {
+	std::string defines = sceneDefines();
+	auto found = rayVariants.find(defines);
+	if (found != rayVariants.end()) {
+		rayShader = found->second;
 		return;
-
-	//get a count of all objects
-	int verticeCount = 0;
-	int uvCount = 0;
-	int faceCount = 0;
-	while (fgets(str, BUFFER_SIZE, p_obj) != NULL) {
-		if (str[0] == 'v') {
-			if (str[1] == ' ')
-				++verticeCount;
-			else if (str[1] == 't')
-				++uvCount;
-		}
-		else if (str[0] == 'f') {
-			++faceCount;
-		}
 	}
 
-	//fill index buffers & build Triangles
-	float* vertices = new float[3 * verticeCount]{ 0 };
-	float* uvs = new float[2 * uvCount]{ 0 };
-	Hitable* faces = objArray + at;
-
-	rewind(p_obj);
-	verticeCount = 0;
-	uvCount = 0;
-	faceCount = 0;
-	while (fgets(str, BUFFER_SIZE, p_obj) != NULL) {
-		if (str[0] == 'v') {
-			if (str[1] == ' ') {
-				int cursor = 2;
-				for (int i = 0; i < 3; ++i) {
-					char value[16];
-					int start = cursor;
-					while (str[cursor] != ' ' && str[cursor] != '\n') {
-						value[cursor - start] = str[cursor];
-						++cursor;
-					}
-					value[cursor - start] = '\0';
-					sscanf_s(value, "%f", &vertices[verticeCount]);
-					++verticeCount;
-					++cursor;
-				}
-			}
-			else if (str[1] == 't') {
-				int cursor = 3;
-				for (int i = 0; i < 2; ++i) {
-					char value[10];
-					int start = cursor;
-					while (str[cursor] != ' ' && str[cursor] != '\n') {
-						value[cursor - start] = str[cursor];
-						++cursor;
-					}
-					value[cursor - start] = '\0';
-					sscanf_s(value, "%f", &uvs[uvCount]);
-					++uvCount;
-					++cursor;
-				}
-			}
-		}
-		else if (str[0] == 'f') {
-			int cursor = 2;
-			*faces = Hitable();
-			faces->type = 2;
-			faces->matType = refObj.matType;
-			faces->texId = refObj.texId;
-			faces->fuzz = refObj.fuzz;
-			faces->refIdx = refObj.refIdx;
-			for (int i = 0; i < 3; ++i) {
-				char value[16];
-				int start = cursor;
-				while (str[cursor] != ' ' && str[cursor] != '\n') {
-					value[cursor - start] = str[cursor];
-					++cursor;
-				}
-				value[cursor - start] = '\0';
-				int indices[2];
-				sscanf_s(value, "%d %*c %d", &indices[0], &indices[1]);
-
-				if (i == 0) {
-					memcpy(faces->A, vertices + ((indices[0] - 1) * 3), 3 * sizeof(float));
-					if (indices[1] != 0)
-						memcpy(faces->uvA, uvs + ((indices[1] - 1) * 2), 2 * sizeof(float));
-				}
-				else if (i == 1) {
-					memcpy(faces->B, vertices + ((indices[0] - 1) * 3), 3 * sizeof(float));
-					if (indices[1] != 0)
-						memcpy(faces->uvB, uvs + ((indices[1] - 1) * 2), 2 * sizeof(float));
-				}
-				else {
-					memcpy(faces->C, vertices + ((indices[0] - 1) * 3), 3 * sizeof(float));
-					if (indices[1] != 0)
-						memcpy(faces->uvC, uvs + ((indices[1] - 1) * 2), 2 * sizeof(float));
-				}
-
-				faces->color[i] = refObj.color[i];
-
-				++cursor;
-			}
-			faces++;
-			if (faces > objArray+MAX_OBJ)
-				return;
-		}
-	}
-
-	fclose(p_obj);
-
-	//free
-	delete[] vertices;
-	delete[] uvs;
+	rayShader = new Shader();
+	if (computePath)
+		rayShader->initCompute("rayShader.frag", defines);
+	else
+		rayShader->init("None", "rayShader.frag", defines);
+	rayVariants[defines] = rayShader;
+	setupRayShader(rayShader);
 }
 
-//prepare the world to be rendered
-Hitable world[MAX_OBJ];
-GLuint uboObjs;
-
 //main entry / initialize
 int main(int argc, char* argv[]) {
+	//offline mesh benchmark, no window needed
+	if (argc > 2 && strcmp(argv[1], "-benchmesh") == 0) {
+		benchmarkMesh(argv[2]);
+		return 0;
+	}
+	//offline clustering of a mesh for GeometryStore
+	if (argc > 3 && strcmp(argv[1], "-bakegeometry") == 0) {
+		Mesh mesh;
+		if (!loadObjMesh(argv[2], mesh))
+			return 1;
+		optimizeMesh(mesh);
+		return bakeGeometry(mesh, argv[3]) ? 0 : 1;
+	}
+	//offline texture compression benchmark
+	if (argc > 2 && strcmp(argv[1], "-benchtex") == 0) {
+		benchmarkCompression(argv[2]);
+		return 0;
+	}
+	//offline upscaler check on an .hdr image, rendered at a scale of 0.75 unless given
+	if (argc > 2 && strcmp(argv[1], "-benchupscale") == 0) {
+		benchmarkUpscale(argv[2], argc > 3 ? (float)atof(argv[3]) : 0.75f, rcasStops);
+		return 0;
+	}
+	//-compute starts on the compute path, -env file.hdr lights the scene with an equirectangular hdr sky,
+	//-scale min max bounds the dynamic resolution
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-compute") == 0)
+			computePath = true;
+		else if (strcmp(argv[i], "-env") == 0 && i + 1 < argc)
+			environmentFile = argv[++i];
+		else if (strcmp(argv[i], "-scale") == 0 && i + 2 < argc) {
+			//never above the window, the upscaler only enlarges and the fragment path cannot draw past the window
+			maxRenderScale = std::max(0.01f, std::min((float)atof(argv[i + 2]), 1.0f));
+			minRenderScale = std::max(0.01f, std::min((float)atof(argv[i + 1]), maxRenderScale));
+			i += 2;
+		}
+	}
+
 	//initialize window
 	glutInit(&argc, argv);
 	glutSetOption(GLUT_MULTISAMPLE, 8);
@@ -272,8 +318,6 @@ int main(int argc, char* argv[]) {
 	//initialize GLEW
 	glewInit();
 
-	//initialize shader
-	rayShader.init("None", "rayShader.frag");
 
 	//set up callbacks
 	glutDisplayFunc(display);
@@ -299,6 +343,10 @@ int main(int argc, char* argv[]) {
 		world[i].color[1] = (std::rand() % 100) / 100.0f; 
 		world[i].color[2] = (std::rand() % 100) / 100.0f;
 	}
+	//a small warm light above the spheres
+	world[2] = Sphere(Vector<float>({ 0,6,0 }), 0.5f);
+	world[2].color[0] = world[2].color[1] = world[2].color[2] = 0;
+	world[2].emission[0] = 40; world[2].emission[1] = 34; world[2].emission[2] = 26;
 	//model I/O, uncomment and make room in world array to use
 	/*Hitable refObj;
 	refObj.matType = 2;
@@ -310,12 +358,19 @@ int main(int argc, char* argv[]) {
 	refObj.matType = 3;
 	refObj.texId = 1;
 	loadObj("alignedCube.obj", world, 22, refObj);*/
-
-	int binding_index = 1;
-	rayShader.bind();
-	int block_index = glGetUniformBlockIndex(rayShader.id(), "worldBlock");
-	glUniformBlockBinding(rayShader.id(), block_index, binding_index);
-	rayShader.unbind();
+	//or let the triangle count follow the on-screen size of the model
+	/*meshInstances.push_back(MeshInstance(loadLodChain("cube.obj"), 10, 12, refObj));
+	for (MeshInstance& instance : meshInstances)
+		updateLod(instance, world, eyePos, heightRatio);*/
+	//or stream a baked model, see -bakegeometry
+	/*geometryStore.open("model.geo", 10, 48, refObj);
+	geometryStore.update(eyePos, world);*/
+
+	glGenBuffers(1, &uboLights);
+	glBindBuffer(GL_UNIFORM_BUFFER, uboLights);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(LightBlock), nullptr, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, light_binding, uboLights);
+	updateLights();
 
 	glGenBuffers(1, &uboObjs);
 	glBindBuffer(GL_UNIFORM_BUFFER, uboObjs);
@@ -323,25 +378,34 @@ int main(int argc, char* argv[]) {
 	glBufferData(GL_UNIFORM_BUFFER, sizeof(world), world, GL_DYNAMIC_DRAW);
 	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(world), world);
 	glBindBuffer(GL_UNIFORM_BUFFER, 0);
-
-	//load and bind any textures
-	int twidth, theight;
-	unsigned char* img1 = SOIL_load_image("squareTex.png", &twidth, &theight, 0, SOIL_LOAD_RGBA);
-	unsigned char* img2 = SOIL_load_image("refCubeTex2.png", &twidth, &theight, 0, SOIL_LOAD_RGBA);
-
-	GLuint texArray;
-	glGenTextures(1, &texArray);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D_ARRAY, texArray);
-	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, twidth, theight, 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
-
-	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, twidth, theight, 1, GL_RGBA, GL_UNSIGNED_BYTE, img1);
-	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 1, twidth, theight, 1, GL_RGBA, GL_UNSIGNED_BYTE, img2);
-
-	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	cameraRing.init(sizeof(CameraBlock), camera_binding);
+
+	//load and bind any textures, they decode in the background and appear as they finish
+	textureLoader.load({ "squareTex.png", "refCubeTex2.png" });
+
+	//initialize shader, specialized to the world built above
+	buildSobolDirections(sobolDirections);
+	if (environmentFile != nullptr)
+		environment.load(environmentFile);
+	selectRayShader();
+	presentShader.init("None", "present.frag");
+	setupPresentShader();
+	easuShader.initCompute("upscale.comp", "#define RCAS_PASS 0\n");
+	rcasShader.initCompute("upscale.comp", "#define RCAS_PASS 1\n");
+	temporalShader.initCompute("temporal.comp");
+	denoiseShader.initCompute("denoise.comp", "#define DENOISE_PASS 0\n");
+	atrousShader.initCompute("denoise.comp", "#define DENOISE_PASS 1\n");
+	for (Shader* shader : { &temporalShader, &denoiseShader, &atrousShader })
+		glUniformBlockBinding(shader->id(), shader->block("cameraBlock"), camera_binding);
+	glGenQueries(RING_REGIONS, timerQueries);
+
+	//path count and bounce count, binding fixed in rayShader.frag
+	const GLuint noStats[2] = { 0, 0 };
+	glGenBuffers(1, &statsBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, statsBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(noStats), noStats, GL_DYNAMIC_READ);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, stats_binding, statsBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
 	//check errors
 	printf("glGetError returned %d\n", glGetError());
@@ -390,6 +454,78 @@ void OnKeyboardDown(unsigned char key, int x, int y) {
 	else if (key == 's') down = true;
 	else if (key == 'a') left = true;
 	else if (key == 'd') right = true;
+	else if (key == 'c') {
+		computePath = !computePath;
+		selectRayShader();
+		accumFrames = 0;
+		gpuTimeMs = 0;
+		gpuTimeFrames = 0;
+		printf("switched to the %s path\n", computePath ? "compute" : "fragment");
+	}
+	else if (key == 'r') {
+		rouletteDepth = rouletteDepth > 0 ? 0 : 3;
+		selectRayShader();
+		accumFrames = 0;
+		gpuTimeMs = 0;
+		gpuTimeFrames = 0;
+		printf("russian roulette %s\n", rouletteDepth > 0 ? "on" : "off");
+	}
+	else if (key == 'l') {
+		lowDiscrepancy = !lowDiscrepancy;
+		selectRayShader();
+		accumFrames = 0;
+		printf("%s sampling\n", lowDiscrepancy ? "sobol" : "random");
+	}
+	else if (key == 'v') {
+		adaptiveSampling = !adaptiveSampling;
+		temporal &= !adaptiveSampling;
+		checkerboard &= temporal;
+		selectRayShader();
+		accumFrames = 0;
+		gpuTimeMs = 0;
+		gpuTimeFrames = 0;
+		printf("adaptive sampling %s\n", adaptiveSampling ? "on" : "off");
+	}
+	else if (key == 't') {
+		temporal = !temporal;
+		adaptiveSampling &= !temporal;
+		checkerboard &= temporal;
+		selectRayShader();
+		accumFrames = 0;
+		printf("temporal accumulation %s\n", temporal ? "on" : "off");
+	}
+	else if (key == 'k') {
+		checkerboard = !checkerboard;
+		compareCheckerboard = checkerboard;
+		temporal |= checkerboard;
+		adaptiveSampling &= !temporal;
+		selectRayShader();
+		accumFrames = 0;
+		gpuTimeMs = 0;
+		gpuTimeFrames = 0;
+		printf("checkerboard rendering %s\n", checkerboard ? "on" : "off");
+	}
+	else if (key == 'n') {
+		denoiser = !denoiser;
+		checkDenoiser = denoiser;
+		selectRayShader();
+		printf("denoiser %s\n", denoiser ? "on" : "off");
+	}
+	else if (key == 'z') {
+		dynamicResolution = !dynamicResolution;
+		resolution.configure(1000.0 / targetFPS, minRenderScale, maxRenderScale);
+		resizeTargets();
+		printf("dynamic resolution %s, rendering %dx%d\n", dynamicResolution ? "on" : "off", renderWidth, renderHeight);
+	}
+	else if (key == 'u') {
+		upscaler = !upscaler;
+		checkUpscaler = upscaler;
+		printf("%s upscaling\n", upscaler ? "easu + rcas" : "bilinear");
+	}
+	else if (key == 'p') {
+		pathStats = !pathStats;
+		selectRayShader();
+	}
 	else if (key == 27) glutLeaveMainLoop();
 }
 
@@ -401,6 +537,25 @@ void OnKeyboardUp(unsigned char key, int x, int y) {
 }
 
 void update(void) {
+	textureLoader.poll();
+	//edited shaders swap in between frames
+	for (auto& variant : rayVariants)
+		if (variant.second->pollReload()) {
+			setupRayShader(variant.second);
+			accumFrames = 0;
+		}
+	if (presentShader.pollReload())
+		setupPresentShader();
+	easuShader.pollReload();
+	rcasShader.pollReload();
+	if (temporalShader.pollReload()) {
+		glUniformBlockBinding(temporalShader.id(), temporalShader.block("cameraBlock"), camera_binding);
+		accumFrames = 0;
+	}
+	for (Shader* shader : { &denoiseShader, &atrousShader })
+		if (shader->pollReload())
+			glUniformBlockBinding(shader->id(), shader->block("cameraBlock"), camera_binding);
+
 	dt = glutGet(GLUT_ELAPSED_TIME) / 1000.0 - lastTime;
 	if (dt > 1.0 / targetFPS) {
 		lastTime = glutGet(GLUT_ELAPSED_TIME) / 1000.0;
@@ -412,50 +567,421 @@ void update(void) {
 		if (right) eyePos += rightward * moveSpeed * dt;
 		else if (left) eyePos -= rightward * moveSpeed * dt;
 
+		bool worldChanged = false;
+		for (MeshInstance& instance : meshInstances)
+			worldChanged |= updateLod(instance, world, eyePos, heightRatio);
+		worldChanged |= geometryStore.update(eyePos, world);
+
 		//used if object properties change
-		//glBindBuffer(GL_UNIFORM_BUFFER, uboObjs);
-		//glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(world), world);
-		//glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		if (worldChanged) {
+			updateLights();
+			glBindBuffer(GL_UNIFORM_BUFFER, uboObjs);
+			glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(world), world);
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+			selectRayShader();
+			accumFrames = 0;
+		}
 		glutPostRedisplay();
 	}
 }
 
+//easu from source into easuTex, then rcas into upscaledTex, both at window size
+void upscale(GLuint source) {
+	float con[4];
+	easuConstants(renderWidth, renderHeight, width, height, con);
+	easuShader.bind();
+	glUniform4fv(easuShader.uniform("easuScale"), 1, con);
+	glBindImageTexture(0, source, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+	glBindImageTexture(1, easuTex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+	glDispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	float sharpness = rcasSharpness(rcasStops);
+	rcasShader.bind();
+	glUniform1f(rcasShader.uniform("sharpness"), sharpness);
+	glBindImageTexture(0, easuTex, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+	glBindImageTexture(1, upscaledTex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+	glDispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+	rcasShader.unbind();
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+	if (!checkUpscaler)
+		return;
+	//a stall, once per toggle
+	checkUpscaler = false;
+	std::vector<float> sourceImage((size_t)renderWidth * renderHeight * 4), gpu((size_t)width * height * 4);
+	std::vector<float> cpuEasu(gpu.size()), cpu(gpu.size());
+	glBindTexture(GL_TEXTURE_2D, source);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, sourceImage.data());
+	glBindTexture(GL_TEXTURE_2D, upscaledTex);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, gpu.data());
+	glBindTexture(GL_TEXTURE_2D, 0);
+	easu(sourceImage.data(), renderWidth, renderHeight, con, cpuEasu.data(), width, height);
+	rcas(cpuEasu.data(), width, height, sharpness, cpu.data());
+	float largest = 0;
+	for (size_t i = 0; i < gpu.size(); ++i)
+		largest = std::max(largest, std::fabs(gpu[i] - cpu[i]));
+	printf("upscaler: largest difference from the cpu reference %.2g\n", largest);
+}
+
+//blends frameTex into historyTex and stores the result in accumTex. historyMode 0 starts over, 1 keeps the history
+//where it is for a camera that stood still, 2 reprojects it
+void resolveTemporal(int historyMode) {
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	temporalShader.bind();
+	glUniform1i(temporalShader.uniform("historyMode"), historyMode);
+	glUniform1i(temporalShader.uniform("checkerboard"), checkerboard);
+	glBindImageTexture(0, accumTex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+	glBindImageTexture(1, historyTex, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+	glBindImageTexture(2, frameTex, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+	//an untraced checkerboard pixel takes over the first hit of a neighbour
+	glBindImageTexture(3, positionTex[0], 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+	glBindImageTexture(4, normalTex[0], 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA16F);
+	glBindImageTexture(5, positionTex[1], 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+	glBindImageTexture(6, normalTex[1], 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA16F);
+	glBindImageTexture(7, albedoTex, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA16F);
+	glDispatchCompute((renderWidth + 7) / 8, (renderHeight + 7) / 8, 1);
+	temporalShader.unbind();
+}
+
+//the a-trous denoiser from accumTex into denoisedTex, the taps of each iteration twice as far apart as the last's
+void denoiseFrame() {
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	denoiseShader.bind();
+	glBindImageTexture(0, accumTex, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+	glBindImageTexture(1, denoiseTex[0], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+	glBindImageTexture(2, positionTex[0], 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+	glBindImageTexture(3, normalTex[0], 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA16F);
+	glBindImageTexture(4, albedoTex, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA16F);
+	glDispatchCompute((renderWidth + 7) / 8, (renderHeight + 7) / 8, 1);
+	atrousShader.bind();
+	for (int i = 0; i < denoiseIterations; ++i) {
+		bool last = i == denoiseIterations - 1;
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		glUniform1i(atrousShader.uniform("stepSize"), 1 << i);
+		glUniform1i(atrousShader.uniform("remodulate"), last);
+		glBindImageTexture(0, denoiseTex[i % 2], 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+		glBindImageTexture(1, last ? denoisedTex : denoiseTex[(i + 1) % 2], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+		glDispatchCompute((renderWidth + 7) / 8, (renderHeight + 7) / 8, 1);
+	}
+	atrousShader.unbind();
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+	if (!checkDenoiser)
+		return;
+	//a stall, once per toggle
+	checkDenoiser = false;
+	size_t size = (size_t)renderWidth * renderHeight * 4;
+	std::vector<float> color(size), position(size), normal(size), albedo(size), gpu(size), cpu(size);
+	auto read = [](GLuint tex, std::vector<float>& image) {
+		glBindTexture(GL_TEXTURE_2D, tex);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, image.data());
+	};
+	read(accumTex, color);
+	read(positionTex[0], position);
+	read(normalTex[0], normal);
+	read(albedoTex, albedo);
+	read(denoisedTex, gpu);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	float eye[3] = { eyePos[0], eyePos[1], eyePos[2] };
+	int start = glutGet(GLUT_ELAPSED_TIME);
+	denoise(color.data(), position.data(), normal.data(), albedo.data(), renderWidth, renderHeight, eye, heightRatio * height / renderHeight,
+		denoiseIterations, cpu.data());
+	int elapsed = glutGet(GLUT_ELAPSED_TIME) - start;
+	//compared as the present pass shows them, clipped and with gamma 2.2, like compareFullFrame
+	auto shown = [](float v) { return std::pow(std::min(std::max(v, 0.0f), 1.0f), 1.0f / 2.2f); };
+	float largest = 0;
+	for (size_t i = 0; i < size; ++i)
+		if (i % 4 != 3)
+			largest = std::max(largest, std::fabs(shown(gpu[i]) - shown(cpu[i])));
+	printf("denoiser: the cpu filter took %d ms, largest difference from the gpu after gamma %.2g\n", elapsed, largest);
+}
+
+//the ray pass, into accumTex or with temporal accumulation into frameTex and resolved from there
+void traceFrame(int historyMode) {
+	rayShader->bind();
+	glBindImageTexture(0, accumTex, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+	if (temporal)
+		glBindImageTexture(3, frameTex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+	if (temporal || denoiser) {
+		glBindImageTexture(4, positionTex[0], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+		glBindImageTexture(5, normalTex[0], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+	}
+	if (denoiser)
+		glBindImageTexture(6, albedoTex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+	if (adaptiveSampling) {
+		glBindImageTexture(1, momentTex, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32F);
+		glBindImageTexture(2, tileMaskTex, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+	}
+	//a checkerboard invocation stands for a pair of pixels in the row
+	int traceWidth = checkerboard ? (renderWidth + 1) / 2 : renderWidth;
+	if (computePath)
+		glDispatchCompute((traceWidth + tileSize - 1) / tileSize, (renderHeight + tileSize - 1) / tileSize, 1);
+	else {
+		//the quad covers the viewport whatever its size
+		glViewport(0, 0, traceWidth, renderHeight);
+		glRectf(0, 0, (float)width, (float)height);
+		glViewport(0, 0, width, height);
+	}
+	rayShader->unbind();
+	if (temporal)
+		resolveTemporal(historyMode);
+}
+
+//traces the frame in full into scratch targets, from the history the checkerboard frame starts from, and returns the
+//accumulated result for compareFullFrame
+GLuint traceFullFrame(int historyMode) {
+	compareCheckerboard = false;
+	//accum, frame, position and normal
+	GLuint scratch[4];
+	GLenum formats[4] = { GL_RGBA32F, GL_RGBA32F, GL_RGBA32F, GL_RGBA16F };
+	glGenTextures(4, scratch);
+	for (int i = 0; i < 4; ++i) {
+		glBindTexture(GL_TEXTURE_2D, scratch[i]);
+		glTexStorage2D(GL_TEXTURE_2D, 1, formats[i], renderWidth, renderHeight);
+	}
+	auto swapTargets = [&]() {
+		std::swap(accumTex, scratch[0]);
+		std::swap(frameTex, scratch[1]);
+		std::swap(positionTex[0], scratch[2]);
+		std::swap(normalTex[0], scratch[3]);
+	};
+	swapTargets();
+	checkerboard = false;
+	selectRayShader();
+	traceFrame(historyMode);
+	swapTargets();
+	checkerboard = true;
+	selectRayShader();
+	glDeleteTextures(3, scratch + 1);
+	return scratch[0];
+}
+
+//prints how far the checkerboard frame in accumTex is from the full one in fullTex after gamma, then deletes fullTex.
+//a stall, once per toggle and report
+void compareFullFrame(GLuint fullTex) {
+	glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+	size_t size = (size_t)renderWidth * renderHeight * 4;
+	std::vector<float> full(size), half(size);
+	glBindTexture(GL_TEXTURE_2D, fullTex);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, full.data());
+	glBindTexture(GL_TEXTURE_2D, accumTex);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, half.data());
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glDeleteTextures(1, &fullTex);
+	//what the present pass shows, clipped and with gamma 2.2
+	auto shown = [](float v) { return std::pow(std::min(std::max(v, 0.0f), 1.0f), 1.0f / 2.2f); };
+	double error = 0;
+	for (size_t i = 0; i < size; ++i)
+		if (i % 4 != 3) {
+			double d = shown(half[i]) - shown(full[i]);
+			error += d * d;
+		}
+	double rms = std::sqrt(error / ((double)renderWidth * renderHeight * 3));
+	printf("checkerboard: %.4f rms error against tracing every pixel, %.2f dB\n", rms, -20 * std::log10(std::max(rms, 1e-10)));
+}
+
 void display(void) {
 	glClear(GL_COLOR_BUFFER_BIT);
+	//a scale picked from the last query applies before anything of this frame is set up
+	if (renderScaleChanged) {
+		renderScaleChanged = false;
+		resizeTargets();
+		printf("render scale %.2f, %dx%d\n", resolution.scale(), renderWidth, renderHeight);
+	}
 
-	rayShader.bind();
-
-	int resolutionLoc = glGetUniformLocation(rayShader.id(), "resolution");
-	glUniform2f(resolutionLoc, width, height);
-	int resInvLoc = glGetUniformLocation(rayShader.id(), "resInv");
-	glUniform2f(resInvLoc, 1.0/width, 1.0/height);
-	int heightRatioLoc = glGetUniformLocation(rayShader.id(), "heightRatio");
-	glUniform1f(heightRatioLoc, heightRatio);
-	int eyeLoc = glGetUniformLocation(rayShader.id(), "eye");
-	glUniform3f(eyeLoc, eyePos[0], eyePos[1], eyePos[2]);
-	int viewLoc = glGetUniformLocation(rayShader.id(), "viewRot");
-	float* viewRotArr = new float[9];
+	//camera state goes straight into mapped memory, no uniform calls
+	CameraBlock* camera = (CameraBlock*)cameraRing.acquire();
+	float viewRotArr[9];
 	viewRotMat.toColArray(viewRotArr);
-	glUniformMatrix3fv(viewLoc, 1, GL_FALSE, viewRotArr);
-	delete[] viewRotArr;
+	for (int c = 0; c < 3; ++c)
+		for (int r = 0; r < 3; ++r)
+			camera->viewRot[4 * c + r] = viewRotArr[3 * c + r];
+	for (int i = 0; i < 3; ++i)
+		camera->eye[i] = eyePos[i];
+	//fewer pixels over the same field of view
+	camera->heightRatio = heightRatio * height / renderHeight;
+	camera->resolution[0] = (float)renderWidth;
+	camera->resolution[1] = (float)renderHeight;
+	camera->resInv[0] = 1.0f / renderWidth;
+	camera->resInv[1] = 1.0f / renderHeight;
+	camera->frame = frameIndex++;
+
+	//the camera of the frame before, for temporal reprojection
+	for (int i = 0; i < 3; ++i)
+		camera->prevEye[i] = lastCamera[i];
+	for (int c = 0; c < 3; ++c)
+		for (int r = 0; r < 3; ++r)
+			camera->prevViewRot[4 * c + r] = lastCamera[3 + 3 * c + r];
+
+	//any camera change restarts the average, temporal accumulation reprojects it instead unless something else restarted it
+	bool restart = accumFrames == 0, moved = false;
+	float cameraState[12];
+	memcpy(cameraState, camera->eye, 3 * sizeof(float));
+	memcpy(cameraState + 3, viewRotArr, 9 * sizeof(float));
+	if (memcmp(cameraState, lastCamera, sizeof(cameraState)) != 0) {
+		memcpy(lastCamera, cameraState, sizeof(cameraState));
+		accumFrames = 0;
+		moved = true;
+	}
+	camera->accumFrames = accumFrames++;
+	cameraRing.bind();
+
+	//the query from RING_REGIONS frames ago has long finished, so reading it here does not stall
+	GLuint query = timerQueries[frameIndex % RING_REGIONS];
+	if (frameIndex > RING_REGIONS) {
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+		gpuTimeMs += elapsed * 1e-6;
+		++gpuTimeFrames;
+		if (dynamicResolution && queryFullFrame[frameIndex % RING_REGIONS])
+			renderScaleChanged = resolution.addFrame(elapsed * 1e-6);
+	}
+	queryFullFrame[frameIndex % RING_REGIONS] = !adaptiveSampling || accumFrames <= adaptiveMinFrames + 1;
 
-	glBegin(GL_QUADS);
-	glVertex2f(0, 0);
-	glVertex2f(width, 0);
-	glVertex2f(width, height);
-	glVertex2f(0, height);
-	glEnd();
+	if (temporal) {
+		std::swap(accumTex, historyTex);
+		std::swap(positionTex[0], positionTex[1]);
+		std::swap(normalTex[0], normalTex[1]);
+	}
+	int historyMode = restart ? 0 : moved ? 2 : 1;
+	//the full frame a checkerboard one is compared with is traced outside the query, it would double the frame's time
+	GLuint fullTex = compareCheckerboard ? traceFullFrame(historyMode) : 0;
+	glBeginQuery(GL_TIME_ELAPSED, query);
+	traceFrame(historyMode);
+	glEndQuery(GL_TIME_ELAPSED);
+	if (fullTex != 0)
+		compareFullFrame(fullTex);
+
+	//the present pass samples what the ray pass wrote, and the next frame loads it again
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	GLuint shownTex = accumTex;
+	if (denoiser && accumFrames <= denoiseFrames) {
+		denoiseFrame();
+		shownTex = denoisedTex;
+	}
+	//after the last pass that reads the camera
+	cameraRing.release();
+	if (upscaler && upscaledTex != 0) {
+		upscale(shownTex);
+		shownTex = upscaledTex;
+	}
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, shownTex);
+	presentShader.bind();
+	glUniform2f(presentShader.uniform("outputInv"), 1.0f / width, 1.0f / height);
+	glRectf(0, 0, (float)width, (float)height);
+	presentShader.unbind();
+	glActiveTexture(GL_TEXTURE0);
 
-	rayShader.unbind();
+	double now = glutGet(GLUT_ELAPSED_TIME) / 1000.0;
+	if (now - gpuTimeStart > 2.0 && gpuTimeFrames > 0) {
+		printf("%s path: %.2f ms per frame on the gpu over %d frames\n", computePath ? "compute" : "fragment", gpuTimeMs / gpuTimeFrames, gpuTimeFrames);
+		if (dynamicResolution)
+			printf("render scale %.2f, %dx%d for a %.1f ms budget\n", resolution.scale(), renderWidth, renderHeight, 1000.0 / targetFPS);
+		compareCheckerboard |= checkerboard && pathStats;
+		if (pathStats) {
+			//a stall, but only every couple of seconds and only while stats are on
+			GLuint counts[2] = { 0, 0 };
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, statsBuffer);
+			glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counts), counts);
+			if (counts[0] > 0)
+				printf("%.2f bounces per path over %u paths\n", (double)counts[1] / counts[0], counts[0]);
+			if (adaptiveSampling)
+				printf("%.1f%% of pixels still sampled\n", 100.0 * counts[0] / ((double)gpuTimeFrames * renderWidth * renderHeight * samples));
+			counts[0] = counts[1] = 0;
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counts), counts);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		}
+		gpuTimeMs = 0;
+		gpuTimeFrames = 0;
+		gpuTimeStart = now;
+	}
 
 	glutSwapBuffers();
 }
 
+void resizeTargets() {
+	renderWidth = dynamicResolution ? resolution.scaled(width) : std::max(1, (int)std::lround(width * maxRenderScale));
+	renderHeight = dynamicResolution ? resolution.scaled(height) : std::max(1, (int)std::lround(height * maxRenderScale));
+	resolution.reset();
+
+	//the upscaler's targets are only needed below the window size
+	glDeleteTextures(1, &easuTex);
+	glDeleteTextures(1, &upscaledTex);
+	easuTex = upscaledTex = 0;
+	if (renderWidth != width || renderHeight != height) {
+		glGenTextures(1, &easuTex);
+		glBindTexture(GL_TEXTURE_2D, easuTex);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, width, height);
+		glGenTextures(1, &upscaledTex);
+		glBindTexture(GL_TEXTURE_2D, upscaledTex);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	}
+
+	//storage is immutable so a new size means a new texture, and a new average. the history takes turns being shown
+	for (GLuint* tex : { &accumTex, &historyTex }) {
+		glDeleteTextures(1, tex);
+		glGenTextures(1, tex);
+		glBindTexture(GL_TEXTURE_2D, *tex);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, renderWidth, renderHeight);
+		//filtered when stretched over the window
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+	glDeleteTextures(1, &frameTex);
+	glGenTextures(1, &frameTex);
+	glBindTexture(GL_TEXTURE_2D, frameTex);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, renderWidth, renderHeight);
+	glDeleteTextures(2, positionTex);
+	glGenTextures(2, positionTex);
+	glDeleteTextures(2, normalTex);
+	glGenTextures(2, normalTex);
+	glDeleteTextures(2, denoiseTex);
+	glGenTextures(2, denoiseTex);
+	for (int i = 0; i < 2; ++i) {
+		glBindTexture(GL_TEXTURE_2D, positionTex[i]);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, renderWidth, renderHeight);
+		glBindTexture(GL_TEXTURE_2D, normalTex[i]);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, renderWidth, renderHeight);
+		glBindTexture(GL_TEXTURE_2D, denoiseTex[i]);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, renderWidth, renderHeight);
+	}
+	glDeleteTextures(1, &albedoTex);
+	glGenTextures(1, &albedoTex);
+	glBindTexture(GL_TEXTURE_2D, albedoTex);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, renderWidth, renderHeight);
+	//shown in place of accumTex
+	glDeleteTextures(1, &denoisedTex);
+	glGenTextures(1, &denoisedTex);
+	glBindTexture(GL_TEXTURE_2D, denoisedTex);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, renderWidth, renderHeight);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glDeleteTextures(1, &momentTex);
+	glGenTextures(1, &momentTex);
+	glBindTexture(GL_TEXTURE_2D, momentTex);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, renderWidth, renderHeight);
+	//every tile is marked again during the first adaptiveMinFrames frames, so the mask needs no clearing
+	glDeleteTextures(1, &tileMaskTex);
+	glGenTextures(1, &tileMaskTex);
+	glBindTexture(GL_TEXTURE_2D, tileMaskTex);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32UI, (renderWidth + tileSize - 1) / tileSize, (renderHeight + tileSize - 1) / tileSize);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	accumFrames = 0;
+}
+
 void reshape(int w, int h) {
 	width = w; height = h;
 	float heightRatio = tan(M_PI*(0.5*FOV) / 180.0) / (0.5*height);
 
 	glViewport(0, 0, (GLsizei)w, (GLsizei)h);
+	resizeTargets();
 	glMatrixMode(GL_PROJECTION);
 	glLoadIdentity();
 	glOrtho(0, width, height, 0, -1, 1);
@@ -0,0 +1,479 @@
+#include "mesh.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <unordered_map>
+#include <random>
+#include <chrono>
+
+//model I/O
+bool loadObjMesh(const char filename[], Mesh& mesh) {
+	const unsigned int BUFFER_SIZE = 1024;
+
+	FILE* p_obj;
+	char str[BUFFER_SIZE];
+
+	fopen_s(&p_obj, filename, "r");
+	if (p_obj == nullptr)
+		return false;
+
+	//get a count of all objects
+	int verticeCount = 0;
+	int uvCount = 0;
+	int faceCount = 0;
+	while (fgets(str, BUFFER_SIZE, p_obj) != NULL) {
+		if (str[0] == 'v') {
+			if (str[1] == ' ')
+				++verticeCount;
+			else if (str[1] == 't')
+				++uvCount;
+		}
+		else if (str[0] == 'f') {
+			++faceCount;
+		}
+	}
+
+	mesh.vertices.assign(3 * verticeCount, 0);
+	mesh.uvs.assign(2 * uvCount, 0);
+	mesh.faces.clear();
+	mesh.faceUVs.clear();
+	mesh.faces.reserve(3 * faceCount);
+	mesh.faceUVs.reserve(3 * faceCount);
+
+	//fill vertex and index buffers
+	rewind(p_obj);
+	verticeCount = 0;
+	uvCount = 0;
+	while (fgets(str, BUFFER_SIZE, p_obj) != NULL) {
+		if (str[0] == 'v') {
+			if (str[1] == ' ') {
+				int cursor = 2;
+				for (int i = 0; i < 3; ++i) {
+					char value[16];
+					int start = cursor;
+					while (str[cursor] != ' ' && str[cursor] != '\n' && str[cursor] != '\0' && cursor - start < 15) {
+						value[cursor - start] = str[cursor];
+						++cursor;
+					}
+					value[cursor - start] = '\0';
+					sscanf_s(value, "%f", &mesh.vertices[verticeCount]);
+					++verticeCount;
+					++cursor;
+				}
+			}
+			else if (str[1] == 't') {
+				int cursor = 3;
+				for (int i = 0; i < 2; ++i) {
+					char value[16];
+					int start = cursor;
+					while (str[cursor] != ' ' && str[cursor] != '\n' && str[cursor] != '\0' && cursor - start < 15) {
+						value[cursor - start] = str[cursor];
+						++cursor;
+					}
+					value[cursor - start] = '\0';
+					sscanf_s(value, "%f", &mesh.uvs[uvCount]);
+					++uvCount;
+					++cursor;
+				}
+			}
+		}
+		else if (str[0] == 'f') {
+			int cursor = 2;
+			for (int i = 0; i < 3; ++i) {
+				char value[16];
+				int start = cursor;
+				while (str[cursor] != ' ' && str[cursor] != '\n' && str[cursor] != '\0' && cursor - start < 15) {
+					value[cursor - start] = str[cursor];
+					++cursor;
+				}
+				value[cursor - start] = '\0';
+				int indices[2] = { 0, 0 };
+				sscanf_s(value, "%d %*c %d", &indices[0], &indices[1]);
+
+				mesh.faces.push_back(indices[0] - 1);
+				mesh.faceUVs.push_back(indices[1] != 0 ? indices[1] - 1 : -1);
+
+				++cursor;
+			}
+		}
+	}
+
+	fclose(p_obj);
+	return true;
+}
+
+//writes up to maxObj - at triangles into objArray, returns the number written
+int meshToHitables(const Mesh& mesh, Hitable* objArray, int at, int maxObj, Hitable refObj) {
+	int count = mesh.faceCount();
+	if (count > maxObj - at)
+		count = maxObj - at;
+
+	for (int f = 0; f < count; ++f) {
+		Hitable* face = objArray + at + f;
+		*face = Hitable();
+		face->type = 2;
+		face->matType = refObj.matType;
+		face->texId = refObj.texId;
+		face->fuzz = refObj.fuzz;
+		face->refIdx = refObj.refIdx;
+
+		float* corners[3] = { face->A, face->B, face->C };
+		float* uvCorners[3] = { face->uvA, face->uvB, face->uvC };
+		for (int i = 0; i < 3; ++i) {
+			memcpy(corners[i], &mesh.vertices[3 * mesh.faces[3 * f + i]], 3 * sizeof(float));
+			int uv = mesh.faceUVs[3 * f + i];
+			if (uv >= 0)
+				memcpy(uvCorners[i], &mesh.uvs[2 * uv], 2 * sizeof(float));
+			face->color[i] = refObj.color[i];
+			face->emission[i] = refObj.emission[i];
+		}
+	}
+
+	return count;
+}
+
+void loadObj(const char filename[], Hitable* objArray, int at, Hitable refObj) {
+	Mesh mesh;
+	if (!loadObjMesh(filename, mesh))
+		return;
+
+	optimizeMesh(mesh);
+	meshToHitables(mesh, objArray, at, MAX_OBJ, refObj);
+}
+
+//post-load optimization
+
+//merges vertices closer than tolerance and drops the triangles this collapses
+int weldVertices(Mesh& mesh, float tolerance) {
+	int count = mesh.vertexCount();
+	if (count == 0)
+		return 0;
+
+	float cell = tolerance > 0 ? tolerance : 1e-6f;
+	float tol2 = tolerance * tolerance;
+	auto cellKey = [](long long x, long long y, long long z) {
+		return ((x & 0x1FFFFF) << 42) | ((y & 0x1FFFFF) << 21) | (z & 0x1FFFFF);
+	};
+
+	//uniform grid of welded vertices, so each vertex only compares against its neighbouring cells
+	std::unordered_map<long long, std::vector<int>> grid;
+	grid.reserve(count);
+	std::vector<int> remap(count);
+	std::vector<float> welded;
+	welded.reserve(3 * count);
+
+	for (int i = 0; i < count; ++i) {
+		const float* p = &mesh.vertices[3 * i];
+		long long c[3];
+		for (int k = 0; k < 3; ++k)
+			c[k] = (long long)std::floor(p[k] / cell);
+
+		int match = -1;
+		for (int dx = -1; dx <= 1 && match == -1; ++dx)
+			for (int dy = -1; dy <= 1 && match == -1; ++dy)
+				for (int dz = -1; dz <= 1 && match == -1; ++dz) {
+					auto found = grid.find(cellKey(c[0] + dx, c[1] + dy, c[2] + dz));
+					if (found == grid.end())
+						continue;
+					for (int j : found->second) {
+						const float* q = &welded[3 * j];
+						float d[3] = { p[0] - q[0], p[1] - q[1], p[2] - q[2] };
+						if (d[0] * d[0] + d[1] * d[1] + d[2] * d[2] <= tol2) {
+							match = j;
+							break;
+						}
+					}
+				}
+
+		if (match == -1) {
+			match = (int)welded.size() / 3;
+			welded.insert(welded.end(), p, p + 3);
+			grid[cellKey(c[0], c[1], c[2])].push_back(match);
+		}
+		remap[i] = match;
+	}
+
+	//remap faces, dropping any that became degenerate
+	int kept = 0;
+	for (int f = 0; f < mesh.faceCount(); ++f) {
+		int a = remap[mesh.faces[3 * f]], b = remap[mesh.faces[3 * f + 1]], c = remap[mesh.faces[3 * f + 2]];
+		if (a == b || b == c || a == c)
+			continue;
+		mesh.faces[3 * kept] = a; mesh.faces[3 * kept + 1] = b; mesh.faces[3 * kept + 2] = c;
+		for (int i = 0; i < 3; ++i)
+			mesh.faceUVs[3 * kept + i] = mesh.faceUVs[3 * f + i];
+		++kept;
+	}
+	mesh.faces.resize(3 * kept);
+	mesh.faceUVs.resize(3 * kept);
+
+	mesh.vertices.swap(welded);
+	return count - mesh.vertexCount();
+}
+
+//spreads the low 10 bits of v so there are two zero bits between each
+static unsigned int expandBits(unsigned int v) {
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+//30 bit morton code for a point in the unit cube
+static unsigned int morton3D(float x, float y, float z) {
+	unsigned int q[3];
+	float p[3] = { x, y, z };
+	for (int k = 0; k < 3; ++k)
+		q[k] = (unsigned int)std::min(std::max(p[k] * 1024.0f, 0.0f), 1023.0f);
+	return (expandBits(q[0]) << 2) | (expandBits(q[1]) << 1) | expandBits(q[2]);
+}
+
+//sorts triangles along a morton curve through their centroids, then renumbers vertices and uvs in order of first use
+void reorderMorton(Mesh& mesh) {
+	int faceCount = mesh.faceCount();
+	if (faceCount == 0)
+		return;
+
+	std::vector<float> centroids(3 * faceCount);
+	float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (int f = 0; f < faceCount; ++f) {
+		for (int k = 0; k < 3; ++k) {
+			float c = 0;
+			for (int i = 0; i < 3; ++i)
+				c += mesh.vertices[3 * mesh.faces[3 * f + i] + k];
+			c /= 3;
+			centroids[3 * f + k] = c;
+			lo[k] = std::min(lo[k], c);
+			hi[k] = std::max(hi[k], c);
+		}
+	}
+
+	float scale[3];
+	for (int k = 0; k < 3; ++k)
+		scale[k] = hi[k] > lo[k] ? 1.0f / (hi[k] - lo[k]) : 0.0f;
+
+	std::vector<std::pair<unsigned int, int>> order(faceCount);
+	for (int f = 0; f < faceCount; ++f) {
+		const float* c = &centroids[3 * f];
+		order[f] = { morton3D((c[0] - lo[0]) * scale[0], (c[1] - lo[1]) * scale[1], (c[2] - lo[2]) * scale[2]), f };
+	}
+	std::sort(order.begin(), order.end());
+
+	std::vector<int> vertMap(mesh.vertexCount(), -1), uvMap(mesh.uvs.size() / 2, -1);
+	std::vector<int> faces(3 * faceCount), faceUVs(3 * faceCount);
+	std::vector<float> vertices, uvs;
+	vertices.reserve(mesh.vertices.size());
+	uvs.reserve(mesh.uvs.size());
+
+	for (int f = 0; f < faceCount; ++f) {
+		int src = order[f].second;
+		for (int i = 0; i < 3; ++i) {
+			int v = mesh.faces[3 * src + i];
+			if (vertMap[v] == -1) {
+				vertMap[v] = (int)vertices.size() / 3;
+				vertices.insert(vertices.end(), &mesh.vertices[3 * v], &mesh.vertices[3 * v] + 3);
+			}
+			faces[3 * f + i] = vertMap[v];
+
+			int uv = mesh.faceUVs[3 * src + i];
+			if (uv >= 0 && uvMap[uv] == -1) {
+				uvMap[uv] = (int)uvs.size() / 2;
+				uvs.insert(uvs.end(), &mesh.uvs[2 * uv], &mesh.uvs[2 * uv] + 2);
+			}
+			faceUVs[3 * f + i] = uv >= 0 ? uvMap[uv] : -1;
+		}
+	}
+
+	mesh.vertices.swap(vertices);
+	mesh.uvs.swap(uvs);
+	mesh.faces.swap(faces);
+	mesh.faceUVs.swap(faceUVs);
+}
+
+void optimizeMesh(Mesh& mesh, float weldTolerance) {
+	weldVertices(mesh, weldTolerance);
+	reorderMorton(mesh);
+}
+
+//benchmark
+
+//bounds of a run of consecutive triangles. tight runs are what morton order buys us
+struct TriChunk {
+	float lo[3], hi[3];
+	int first, count;
+};
+
+static std::vector<TriChunk> buildChunks(const std::vector<Hitable>& tris, int chunkSize) {
+	std::vector<TriChunk> chunks;
+	for (int first = 0; first < (int)tris.size(); first += chunkSize) {
+		TriChunk chunk = { { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX }, first, std::min(chunkSize, (int)tris.size() - first) };
+		for (int t = first; t < first + chunk.count; ++t) {
+			const float* corners[3] = { tris[t].A, tris[t].B, tris[t].C };
+			for (int i = 0; i < 3; ++i)
+				for (int k = 0; k < 3; ++k) {
+					chunk.lo[k] = std::min(chunk.lo[k], corners[i][k]);
+					chunk.hi[k] = std::max(chunk.hi[k], corners[i][k]);
+				}
+		}
+		chunks.push_back(chunk);
+	}
+	return chunks;
+}
+
+//slab test, returns the entry distance or -1 on a miss
+static float hitBox(const float lo[3], const float hi[3], const float o[3], const float invD[3], float maxT) {
+	float t0 = 0, t1 = maxT;
+	for (int k = 0; k < 3; ++k) {
+		float a = (lo[k] - o[k]) * invD[k], b = (hi[k] - o[k]) * invD[k];
+		if (a > b) std::swap(a, b);
+		t0 = std::max(t0, a);
+		t1 = std::min(t1, b);
+		if (t0 > t1)
+			return -1;
+	}
+	return t0;
+}
+
+//same plane + edge test as rayShader.frag
+static float hitTriangle(const Hitable& tri, const float o[3], const float d[3]) {
+	float e0[3], e1[3], n[3];
+	for (int k = 0; k < 3; ++k) {
+		e0[k] = tri.B[k] - tri.A[k];
+		e1[k] = tri.C[k] - tri.B[k];
+	}
+	n[0] = e0[1] * e1[2] - e0[2] * e1[1];
+	n[1] = e0[2] * e1[0] - e0[0] * e1[2];
+	n[2] = e0[0] * e1[1] - e0[1] * e1[0];
+
+	float nd = n[0] * d[0] + n[1] * d[1] + n[2] * d[2];
+	if (nd == 0)
+		return -1;
+	float t = (n[0] * (tri.A[0] - o[0]) + n[1] * (tri.A[1] - o[1]) + n[2] * (tri.A[2] - o[2])) / nd;
+	if (t <= 0)
+		return -1;
+
+	float p[3] = { o[0] + t * d[0], o[1] + t * d[1], o[2] + t * d[2] };
+	const float* corners[3] = { tri.A, tri.B, tri.C };
+	for (int i = 0; i < 3; ++i) {
+		const float* a = corners[i];
+		const float* b = corners[(i + 1) % 3];
+		float ab[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+		float ap[3] = { p[0] - a[0], p[1] - a[1], p[2] - a[2] };
+		float c[3] = { ab[1] * ap[2] - ab[2] * ap[1], ab[2] * ap[0] - ab[0] * ap[2], ab[0] * ap[1] - ab[1] * ap[0] };
+		if (c[0] * n[0] + c[1] * n[1] + c[2] * n[2] <= 0)
+			return -1;
+	}
+	return t;
+}
+
+//closest hit for every ray up to maxT, culling chunks by their bounds. with anyHit a ray stops at the first triangle it hits,
+//which is all a shadow ray needs. returns rays per second
+static double traceRays(const std::vector<Hitable>& tris, const std::vector<float>& rays, int& hits, double& trisTested, float maxT = FLT_MAX, bool anyHit = false) {
+	std::vector<TriChunk> chunks = buildChunks(tris, 32);
+	int rayCount = (int)rays.size() / 6;
+	hits = 0;
+	long long tested = 0;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int r = 0; r < rayCount; ++r) {
+		const float* o = &rays[6 * r];
+		const float* d = &rays[6 * r + 3];
+		float invD[3] = { 1.0f / d[0], 1.0f / d[1], 1.0f / d[2] };
+		float hitPt = maxT;
+		bool hit = false;
+
+		for (const TriChunk& chunk : chunks) {
+			if (hitBox(chunk.lo, chunk.hi, o, invD, hitPt) < 0)
+				continue;
+			for (int t = chunk.first; t < chunk.first + chunk.count; ++t) {
+				++tested;
+				float at = hitTriangle(tris[t], o, d);
+				if (at > 0 && at < hitPt) {
+					hitPt = at;
+					hit = true;
+					if (anyHit)
+						break;
+				}
+			}
+			if (hit && anyHit)
+				break;
+		}
+		if (hit)
+			++hits;
+	}
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	trisTested = (double)tested / rayCount;
+	return rayCount / elapsed.count();
+}
+
+void benchmarkMesh(const char filename[], int rayCount) {
+	Mesh mesh;
+	if (!loadObjMesh(filename, mesh) || mesh.faceCount() == 0) {
+		printf("benchmarkMesh: could not load %s\n", filename);
+		return;
+	}
+
+	//random rays from a sphere around the mesh towards points inside its bounds
+	float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (int v = 0; v < mesh.vertexCount(); ++v)
+		for (int k = 0; k < 3; ++k) {
+			lo[k] = std::min(lo[k], mesh.vertices[3 * v + k]);
+			hi[k] = std::max(hi[k], mesh.vertices[3 * v + k]);
+		}
+	float center[3], radius = 0;
+	for (int k = 0; k < 3; ++k) {
+		center[k] = 0.5f * (lo[k] + hi[k]);
+		radius += (hi[k] - lo[k]) * (hi[k] - lo[k]);
+	}
+	radius = std::sqrt(radius);
+
+	std::mt19937 gen(1234);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::normal_distribution<float> normal;
+	std::vector<float> rays(6 * rayCount);
+	for (int r = 0; r < rayCount; ++r) {
+		float dir[3] = { normal(gen), normal(gen), normal(gen) };
+		float len = std::sqrt(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+		float target[3];
+		for (int k = 0; k < 3; ++k) {
+			rays[6 * r + k] = center[k] + radius * dir[k] / len;
+			target[k] = lo[k] + unit(gen) * (hi[k] - lo[k]);
+		}
+		for (int k = 0; k < 3; ++k)
+			rays[6 * r + 3 + k] = target[k] - rays[6 * r + k];
+	}
+
+	Hitable refObj;
+	refObj.matType = 1; refObj.fuzz = 0; refObj.refIdx = 1; refObj.texId = -1;
+	refObj.color[0] = refObj.color[1] = refObj.color[2] = 0.5;
+
+	printf("mesh benchmark: %s, %d rays\n", filename, rayCount);
+	for (int pass = 0; pass < 2; ++pass) {
+		if (pass == 1)
+			optimizeMesh(mesh);
+
+		std::vector<Hitable> tris(mesh.faceCount());
+		meshToHitables(mesh, tris.data(), 0, (int)tris.size(), refObj);
+
+		int hits;
+		double trisTested;
+		double raysPerSec = traceRays(tris, rays, hits, trisTested);
+		printf("  %s: %d vertices, %d triangles, %.3f Mrays/s, %.1f triangles tested per ray, %d hits\n",
+			pass == 0 ? "before" : "after ", mesh.vertexCount(), mesh.faceCount(), raysPerSec * 1e-6, trisTested, hits);
+
+		//visibility between each ray's origin and target, as shadow rays ask it
+		if (pass == 1) {
+			int anyHits;
+			double anyTested;
+			double closestPerSec = traceRays(tris, rays, hits, trisTested, 1.0f);
+			double anyPerSec = traceRays(tris, rays, anyHits, anyTested, 1.0f, true);
+			printf("  visibility: closest hit %.3f Mrays/s, %.1f tested per ray; any hit %.3f Mrays/s, %.1f tested per ray, %d of %d blocked\n",
+				closestPerSec * 1e-6, trisTested, anyPerSec * 1e-6, anyTested, anyHits, hits);
+		}
+	}
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <vector>
+#include "hitable.h"
+
+//indexed triangle mesh, as read from an .obj file
+struct Mesh {
+	std::vector<float> vertices; //xyz triplets
+	std::vector<float> uvs; //uv pairs
+	std::vector<int> faces; //vertex indices, 3 per triangle
+	std::vector<int> faceUVs; //uv indices, 3 per triangle. -1 if the corner has no uv
+
+	int vertexCount() const { return (int)vertices.size() / 3; }
+	int faceCount() const { return (int)faces.size() / 3; }
+};
+
+//model I/O
+bool loadObjMesh(const char filename[], Mesh& mesh);
+int meshToHitables(const Mesh& mesh, Hitable* objArray, int at, int maxObj, Hitable refObj);
+void loadObj(const char filename[], Hitable* objArray, int at, Hitable refObj);
+
+//post-load optimization
+int weldVertices(Mesh& mesh, float tolerance); //returns the number of vertices removed
+void reorderMorton(Mesh& mesh);
+void optimizeMesh(Mesh& mesh, float weldTolerance = 1e-5f);
+
+//prints intersection throughput of a mesh before and after optimization
+void benchmarkMesh(const char filename[], int rayCount = 1 << 16);
@@ -0,0 +1,26 @@
+#pragma once
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+//calls row(y) for every y in [0, height), split into threadCount bands of rows that run on their own threads.
+//threadCount 0 uses one thread per hardware thread, and with a single thread everything runs on the caller's
+template <typename RowFunction>
+void forRows(int height, int threadCount, RowFunction row) {
+	if (threadCount <= 0)
+		threadCount = (int)std::max(1u, std::thread::hardware_concurrency());
+	threadCount = std::min(threadCount, height);
+	auto rows = [&](int first, int last) {
+		for (int y = first; y < last; ++y)
+			row(y);
+	};
+	if (threadCount <= 1) {
+		rows(0, height);
+		return;
+	}
+	std::vector<std::thread> threads;
+	for (int t = 0; t < threadCount; ++t)
+		threads.push_back(std::thread(rows, height * t / threadCount, height * (t + 1) / threadCount));
+	for (std::thread& thread : threads)
+		thread.join();
+}
@@ -0,0 +1,11 @@
+#version 450 compatibility
+
+//shows the accumulated linear image, gamma corrected. it is stretched over the window when rendered at a lower resolution
+uniform sampler2D image;
+//one over the window size
+uniform vec2 outputInv;
+
+void main(){
+	float gamma = 2.2;
+	gl_FragColor = vec4(pow(textureLod(image, gl_FragCoord.xy*outputInv, 0.0).rgb, vec3(1/gamma)), 1.0);
+}
\ No newline at end of file
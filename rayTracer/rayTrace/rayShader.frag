@@ -1,31 +1,191 @@
-#version 450
+#version 450 compatibility
 
-uniform vec2 resolution;
-uniform vec2 resInv; //save a division
-uniform vec3 eye;
-uniform mat3 viewRot;
-uniform float heightRatio;
+//camera state, rewritten by the renderer every frame
+layout (std140) uniform cameraBlock {
+	mat3 viewRot;
+	vec3 eye;
+	float heightRatio;
+	vec2 resolution;
+	vec2 resInv; //save a division
+	int frame; //frames rendered so far, offsets every random seed
+	int accumFrames; //frames already averaged into accumImage, 0 after the camera or scene changed
+	mat3 prevViewRot; //the camera of the frame before, for reprojection
+	vec3 prevEye;
+};
 
-//some helpful macros
+//some helpful macros, the first four can be overridden by defines passed to Shader::init
+#ifndef SAMPLES
 #define SAMPLES 2
+#endif
+#ifndef MAX_BOUNCES
 #define MAX_BOUNCES 25
+#endif
+#ifndef MAX_OBJ
 #define MAX_OBJ 64
-#define FLT_MAX 3.402823466e+38
+#endif
+#ifndef EPSILON
 #define EPSILON 0.00005
+#endif
+#define FLT_MAX 3.402823466e+38
+#define MAX_TEX 16
+#define MAX_LIGHTS 16
+#define INV_PI 0.31830988618
+#define DIFFUSE_SPREAD 0.3 //cone spread after a diffuse bounce, in radians
+
+//primitive and material paths compiled in. the renderer turns off whatever its scene does not contain
+#ifndef HAS_SPHERE
+#define HAS_SPHERE 1
+#endif
+#ifndef HAS_PLANE
+#define HAS_PLANE 1
+#endif
+#ifndef HAS_TRIANGLE
+#define HAS_TRIANGLE 1
+#endif
+#ifndef HAS_QUAD
+#define HAS_QUAD 1
+#endif
+#ifndef HAS_TEXTURE
+#define HAS_TEXTURE 1
+#endif
+#ifndef HAS_DIFFUSE
+#define HAS_DIFFUSE 1
+#endif
+#ifndef HAS_REFLECTIVE
+#define HAS_REFLECTIVE 1
+#endif
+#ifndef HAS_DIELECTRIC
+#define HAS_DIELECTRIC 1
+#endif
+//emissive objects. the listed ones are sampled directly from diffuse hits with shadow rays, weighted against bsdf sampling by mis
+#ifndef HAS_LIGHTS
+#define HAS_LIGHTS 1
+#endif
+//equirectangular hdr sky instead of the gradient, sampled by brightness from diffuse hits and weighted against bsdf sampling by mis
+#ifndef HAS_ENV_MAP
+#define HAS_ENV_MAP 0
+#endif
+
+//path termination. after ROULETTE_DEPTH bounces a path survives with probability equal to its brightest throughput channel
+//and survivors are scaled up to stay unbiased, 0 turns it off. paths dimmer than THROUGHPUT_CUTOFF stop outright, which
+//is cheaper but darkens the image slightly, 0 turns it off
+#ifndef ROULETTE_DEPTH
+#define ROULETTE_DEPTH 3
+#endif
+#ifndef THROUGHPUT_CUTOFF
+#define THROUGHPUT_CUTOFF 0.0
+#endif
+
+//counts paths and bounces for the renderer's report, costs an atomic per sample
+#ifndef PATH_STATS
+#define PATH_STATS 0
+#endif
+#if PATH_STATS
+layout (std430, binding = 3) buffer pathStatsBlock {
+	uint pathCount;
+	uint bounceCount;
+};
+#endif
+
+//draws the camera jitter and every bounce from owen scrambled sobol points instead of the pcg generator,
+//so the error falls faster as samples accumulate
+#ifndef LOW_DISCREPANCY
+#define LOW_DISCREPANCY 1
+#endif
+
+//built as a compute shader instead, one invocation per pixel in TILE_SIZE x TILE_SIZE workgroups
+#ifndef COMPUTE_PATH
+#define COMPUTE_PATH 0
+#endif
+#ifndef TILE_SIZE
+#define TILE_SIZE 8
+#endif
+#if COMPUTE_PATH
+layout (local_size_x = TILE_SIZE, local_size_y = TILE_SIZE) in;
+#endif
+
+//running mean of every frame since the last reset, in linear color. both paths write it, the present pass shows it
+layout (rgba32f) uniform image2D accumImage;
+
+//adaptive sampling. once ADAPTIVE_MIN_FRAMES frames are averaged, a TILE_SIZE x TILE_SIZE tile whose pixels all have a
+//standard error below ADAPTIVE_THRESHOLD, measured after gamma, stops rendering until the average restarts. the tiles still
+//converging keep tracing SAMPLES a frame, so a frame gets cheaper instead of spending the time elsewhere
+#ifndef ADAPTIVE_SAMPLING
+#define ADAPTIVE_SAMPLING 0
+#endif
+#ifndef ADAPTIVE_MIN_FRAMES
+#define ADAPTIVE_MIN_FRAMES 16
+#endif
+#ifndef ADAPTIVE_THRESHOLD
+#define ADAPTIVE_THRESHOLD 0.01
+#endif
+#if ADAPTIVE_SAMPLING
+//running mean of each frame's squared luminance, next to the mean in accumImage it gives the variance
+layout (r32f, binding = 1) uniform image2D momentImage;
+//one texel per tile, the last frame in which one of its pixels had not converged
+layout (r32ui, binding = 2) uniform uimage2D tileMask;
+#endif
+
+//temporal accumulation, the camera may move without losing the average. this pass leaves each frame's color in
+//frameImage, with the world position and normal its first sample saw first, and temporal.comp blends it into the
+//history reprojected from the frame before
+#ifndef TEMPORAL
+#define TEMPORAL 0
+#endif
+//checkerboard rendering, with temporal accumulation only. each frame traces the pixels with x + y + frame even, half
+//of them, and temporal.comp fills in the rest. the dispatch or viewport spans half the width
+#ifndef CHECKERBOARD
+#define CHECKERBOARD 0
+#endif
+//the denoiser, see denoise.comp, is guided by the same first hits and their albedo
+#ifndef DENOISE
+#define DENOISE 0
+#endif
+#if TEMPORAL
+layout (rgba32f, binding = 3) uniform writeonly image2D frameImage;
+#endif
+#if TEMPORAL || DENOISE
+//xyz position, w 1 for a hit and 0 for sky
+layout (rgba32f, binding = 4) uniform writeonly image2D positionImage;
+layout (rgba16f, binding = 5) uniform writeonly image2D normalImage;
+vec4 primaryPosition;
+vec3 primaryNormal;
+#endif
+#if DENOISE
+//color or texel of the first hit, 1 for sky
+layout (rgba16f, binding = 6) uniform writeonly image2D albedoImage;
+vec3 primaryAlbedo;
+#endif
 
 uniform sampler2DArray texArray;
+//where each texId was packed: uv scale in xy, offset in zw
+uniform vec4 texRects[MAX_TEX];
+uniform int texLayers[MAX_TEX];
+
+#if HAS_ENV_MAP
+//radiance, v = 0 looking straight up
+uniform sampler2D envMap;
+//one cdf over columns per row and the cdf over rows, of luminance times sin theta. built by EnvironmentMap in envMap.cpp
+uniform sampler2D envConditional;
+uniform sampler2D envMarginal;
+//turns a texel's luminance into the solid angle pdf of sampling it
+uniform float envPdfScale;
+#endif
+
+//sobol direction numbers, one per index bit with a dimension in each component. filled in by buildSobolDirections in sobol.cpp
+uniform uvec4 sobolDirections[32];
 
 //hitable object struct
 struct Hitable{
 	//commented members are positioned to facillitate readability. Their actual declarations are grouped for padding purposes.
-	//int type; //-1 = none; 0 = sphere; 1 = plane; 2 = triangle
+	//int type; //-1 = none; 0 = sphere; 1 = plane; 2 = triangle; 3 = quad
 	//sphere properties
 	vec4 center;
 	//float radius;
 	//plane properties
 	vec4 normal;
 	vec4 point;
-	//triangle properties
+	//triangle properties, a quad is the parallelogram with corner A and edges to B and C
 	vec4 A;
 	vec4 B;
 	vec4 C;
@@ -33,6 +193,8 @@ struct Hitable{
 	//material properties
 	//int matType; //-1 = none; 1 = diffuse; 2 = reflective; 3 = dieletric; 
 	vec4 color;
+	//light properties, radiance given off from both sides. w is set when the object is in lightIds
+	vec4 emission;
 	//reflective properties
 	//float fuzz;
 	//refractive properties
@@ -45,7 +207,7 @@ struct Hitable{
 	//int texId;
 
 	//group above commented members for padding purposes
-	int type; //-1 = none; 0 = sphere; 1 = plane; 2 = triangle
+	int type; //-1 = none; 0 = sphere; 1 = plane; 2 = triangle; 3 = quad
 	float radius;
 	int matType; //-1 = none; 1 = diffuse; 2 = reflective; 3 = dieletric
 	float fuzz;
@@ -61,6 +223,12 @@ layout (std140) uniform worldBlock {
     Hitable world[MAX_OBJ];
 };
 
+//indices into world of the objects next event estimation samples, four to an ivec4
+layout (std140) uniform lightBlock {
+	int lightCount;
+	ivec4 lightIds[MAX_LIGHTS/4];
+};
+
 //returns the two intersection distances, closest positive first. Any negative values should be rejected. ce is the vector from sphere center to eye
 vec2 hitSphere(vec3 ce, float r, vec3 ray){
 	float a = dot(ray, ray);
@@ -92,19 +260,115 @@ float hitPlane(vec3 n, vec3 p, vec3 ray){
 		return -1;
 }
 
-//generates a pseudo-random number x where 0.0 <= x < 1.0
-float rand(vec2 co){
-    return fract(sin(dot(co.xy ,vec2(12.9898,78.233))) * 43758.5453);
+//pcg hash, one round of a 32 bit pcg generator used to scramble seeds. rng.h has the same functions on the cpu
+uint pcgHash(uint v){
+	uint state = v*747796405u + 2891336453u;
+	uint word = ((state >> ((state >> 28u) + 4u)) ^ state)*277803737u;
+	return (word >> 22u) ^ word;
+}
+
+//per path generator state, seeded once per pixel and sample
+uint rngState;
+
+void seedRng(uvec2 pixel, uint sampleIndex){
+	rngState = pcgHash(pixel.x + pcgHash(pixel.y + pcgHash(sampleIndex)));
+}
+
+//next 32 random bits, advances the state like a pcg generator
+uint randUint(){
+	uint state = rngState;
+	rngState = rngState*747796405u + 2891336453u;
+	uint word = ((state >> ((state >> 28u) + 4u)) ^ state)*277803737u;
+	return (word >> 22u) ^ word;
+}
+
+//generates a pseudo-random number x where 0.0 <= x < 1.0, from the top 24 bits so every value is exact in a float
+float randFloat(){
+	return float(randUint() >> 8)*(1.0/16777216.0);
+}
+
+//uniform direction on the unit sphere
+vec3 randOnSphere(vec2 u){
+	float z = 1.0 - 2.0*u.x;
+	float phi = 6.28318530718*u.y;
+	float r = sqrt(max(0.0, 1.0 - z*z));
+	return vec3(r*cos(phi), r*sin(phi), z);
+}
+
+//uniform point inside the unit sphere, for fuzzy reflections. u.z picks the radius
+vec3 randInSphere(vec3 u){
+	return randOnSphere(u.xy)*pow(u.z, 1.0/3.0);
 }
 
-//generates a random vector contained in a unit sphere, for lambertian
-vec3 randInSphere(vec2 co){
-	vec3 p;
-	do{
-		p = 2*vec3(rand(co),rand(co*1.23),rand(co*1.57)) - vec3(1,1,1);
-		co += vec2(1,-1);
-	} while (p.x*p.x+p.y*p.y+p.z*p.z > 1);
-	return p;
+//cosine weighted direction around normal n, for lambertian. a unit normal plus a point on the unit sphere has this distribution
+vec3 randCosineHemisphere(vec3 n, vec2 u){
+	vec3 dir = n + randOnSphere(u);
+	float len = dot(dir, dir);
+	return len > 1e-12 ? dir*inversesqrt(len) : n;
+}
+
+//seed of the pixel's sobol sets and the index of the current sample in them. both stay fixed while frames accumulate,
+//so every accumulated sample is the next point of the same sequences
+uint pixelSeed;
+uint sampleIndex;
+
+//laine and karras' hash, on reversed bits each output bit only depends on the input bits below it
+uint laineKarras(uint x, uint seed){
+	x += seed;
+	x ^= x*0x6c50b47cu;
+	x ^= x*0xb82f1e52u;
+	x ^= x*0xc7afe638u;
+	x ^= x*0x8d22f6e6u;
+	return x;
+}
+
+//hash based owen scrambling: every bit of x is flipped by a random choice depending on the bits above it
+uint owenScramble(uint x, uint seed){
+	return bitfieldReverse(laineKarras(bitfieldReverse(x), seed));
+}
+
+//four dimensions for one set of a path: set 0 jitters the camera ray, set n+1 drives bounce n. every set shuffles the
+//point index and scrambles each dimension with its own seed, so sets stay independent while each keeps sobol's stratification
+vec4 sobolSet(uint set){
+#if LOW_DISCREPANCY
+	uint seed = pcgHash(pixelSeed + set);
+	uint index = owenScramble(sampleIndex, seed);
+	uvec4 x = uvec4(0u);
+	for (int bit = 0; index != 0u; ++bit, index >>= 1)
+		if ((index & 1u) != 0u)
+			x ^= sobolDirections[bit];
+	x = uvec4(owenScramble(x.x, pcgHash(seed + 1u)), owenScramble(x.y, pcgHash(seed + 2u)),
+		owenScramble(x.z, pcgHash(seed + 3u)), owenScramble(x.w, pcgHash(seed + 4u)));
+	return vec4(x >> 8u)*(1.0/16777216.0);
+#else
+	return vec4(randFloat(), randFloat(), randFloat(), randFloat());
+#endif
+}
+
+//maps a texture's own uv into the packed array, clamped inside its rect so neighbours never bleed in at the given lod
+vec3 atlasCoord(vec2 uv, int texId, float lod){
+	vec4 rect = texRects[texId];
+	vec2 halfTexel = 0.5*exp2(lod)/vec2(textureSize(texArray, 0).xy);
+	vec2 coord = clamp(rect.zw + uv*rect.xy, rect.zw + halfTexel, rect.zw + rect.xy - halfTexel);
+	return vec3(coord, texLayers[texId]);
+}
+
+//ray cone texture lod on a triangle: texel to world area ratio, then the cone footprint on the surface
+float coneLod(int n, float width, vec3 normal, vec3 dir){
+	vec2 texSize = texRects[world[n].texId].xy*vec2(textureSize(texArray, 0).xy);
+	vec2 uvAB = (world[n].uvB - world[n].uvA)*texSize, uvAC = (world[n].uvC - world[n].uvA)*texSize;
+	float texArea = abs(uvAB.x*uvAC.y - uvAB.y*uvAC.x);
+	float worldArea = length(cross(world[n].B.xyz - world[n].A.xyz, world[n].C.xyz - world[n].A.xyz));
+	float cosine = max(abs(dot(normal, normalize(dir))), EPSILON);
+	float lod = 0.5*log2(texArea/worldArea) + log2(width/cosine);
+	return clamp(lod, 0.0, float(textureQueryLevels(texArray) - 1));
+}
+
+//extra cone spread from bouncing off a curved surface
+float curvatureSpread(int n, float width){
+	if (world[n].type == 0)
+		return 2.0*width/world[n].radius;
+	return 0.0;
 }
 
 //schlick's approximation for reflectance coefficient
@@ -114,73 +378,300 @@ float schlick(float cosine,float n1,float n2){
 	return r0 + (1-r0)*pow(1-cosine,5);
 }
 
-//fsaa
-vec2 sampleDeflect(vec2 coord, int pNum){
-	if (pNum == 0)
-		return coord;
-	else
-		return coord + vec2(sin(pNum*1.618)*0.75,cos(pNum*1.618)*0.75);
+//nearest object along ray from origin, -1 if nothing is hit. hitPt is in units of ray, hitNormal is the geometric normal
+int closestHit(vec3 origin, vec3 ray, out float hitPt, out vec3 hitNormal){
+	int hitIdx = -1;
+	hitPt = FLT_MAX;
+
+	for (int n = 0; n < MAX_OBJ; ++n){
+#if HAS_SPHERE
+		if (world[n].type == 0){
+			vec2 hitPts = hitSphere(origin-world[n].center.xyz, world[n].radius, ray);
+			if (hitPts[0] > EPSILON && hitPts[0] < hitPt){
+				hitIdx = n;
+				hitPt = hitPts[0];
+				hitNormal = sphereNormal(world[n].center.xyz, origin+hitPt*ray);
+			}
+		}
+#endif
+#if HAS_PLANE
+		if (world[n].type == 1){
+			float hit = hitPlane(world[n].normal.xyz, world[n].point.xyz - origin, ray);
+			if (hit > EPSILON && hit < hitPt){
+				hitIdx = n;
+				hitPt = hit;
+				hitNormal = world[n].normal.xyz;
+			}
+		}
+#endif
+#if HAS_TRIANGLE
+		if (world[n].type == 2){
+			vec3 A = world[n].A.xyz, B = world[n].B.xyz, C = world[n].C.xyz;
+			vec3 normal = normalize(cross(B-A,C-B));
+			float hit = hitPlane(normal, A - origin, ray);
+			if (hit > EPSILON && hit < hitPt){
+				vec3 p = origin + hit*ray;
+				if (dot(cross(B-A, p-A),normal) > 0 && dot(cross(C-B, p-B),normal) > 0 && dot(cross(A-C, p-C),normal) > 0){
+					hitIdx = n;
+					hitPt = hit;
+					hitNormal = normal;
+				}
+			}
+		}
+#endif
+#if HAS_QUAD
+		if (world[n].type == 3){
+			vec3 A = world[n].A.xyz, edgeB = world[n].B.xyz - A, edgeC = world[n].C.xyz - A;
+			vec3 normal = cross(edgeB, edgeC);
+			float hit = hitPlane(normal, A - origin, ray);
+			if (hit > EPSILON && hit < hitPt){
+				//coordinates of the hit along both edges, inside when both are in [0,1]
+				vec3 d = origin + hit*ray - A;
+				float invLen = 1.0/dot(normal, normal);
+				float s = dot(cross(d, edgeC), normal)*invLen, t = dot(cross(edgeB, d), normal)*invLen;
+				if (s >= 0 && s <= 1 && t >= 0 && t <= 1){
+					hitIdx = n;
+					hitPt = hit;
+					hitNormal = normal*sqrt(invLen);
+				}
+			}
+		}
+#endif
+	}
+	return hitIdx;
 }
 
-vec2 sampleDeflectRand(vec2 coord, int pNum){
-	if (pNum == 0)
-		return coord;
-	else
-		return coord + vec2(rand(coord*pNum), rand(coord*pNum-1));
+//true if anything other than object skip lies along ray from origin closer than maxT, in units of ray.
+//stops at the first blocker and never works out normals or uvs. the tests are written as selects rather than branches,
+//so neighbouring invocations stay in step and only the loop exit diverges
+bool occluded(vec3 origin, vec3 ray, float maxT, int skip){
+	bool blocked = false;
+	for (int n = 0; n < MAX_OBJ && !blocked; ++n){
+		float hit = -1.0;
+#if HAS_SPHERE
+		if (world[n].type == 0){
+			//hitSphere without the divisions, nearest root past EPSILON
+			vec3 ce = origin - world[n].center.xyz;
+			float a = dot(ray, ray), b = dot(ray, ce), c = dot(ce, ce) - world[n].radius*world[n].radius;
+			float d = b*b - a*c;
+			float root = sqrt(max(d, 0.0));
+			hit = d < 0.0 ? -1.0 : (-b - root > EPSILON*a ? -b - root : -b + root)/a;
+		}
+#endif
+#if HAS_PLANE
+		if (world[n].type == 1){
+			float nd = dot(world[n].normal.xyz, ray);
+			hit = nd != 0.0 ? dot(world[n].normal.xyz, world[n].point.xyz - origin)/nd : -1.0;
+		}
+#endif
+#if HAS_TRIANGLE
+		if (world[n].type == 2){
+			vec3 A = world[n].A.xyz, B = world[n].B.xyz, C = world[n].C.xyz;
+			vec3 normal = cross(B-A,C-B);
+			float nd = dot(normal, ray);
+			float t = nd != 0.0 ? dot(normal, A - origin)/nd : -1.0;
+			vec3 p = origin + t*ray;
+			bool inside = dot(cross(B-A, p-A),normal) > 0 && dot(cross(C-B, p-B),normal) > 0 && dot(cross(A-C, p-C),normal) > 0;
+			hit = inside ? t : -1.0;
+		}
+#endif
+#if HAS_QUAD
+		if (world[n].type == 3){
+			vec3 A = world[n].A.xyz, edgeB = world[n].B.xyz - A, edgeC = world[n].C.xyz - A;
+			vec3 normal = cross(edgeB, edgeC);
+			float nd = dot(normal, ray);
+			float t = nd != 0.0 ? dot(normal, A - origin)/nd : -1.0;
+			vec3 d = origin + t*ray - A;
+			float invLen = 1.0/dot(normal, normal);
+			float u = dot(cross(d, edgeC), normal)*invLen, v = dot(cross(edgeB, d), normal)*invLen;
+			hit = u >= 0 && u <= 1 && v >= 0 && v <= 1 ? t : -1.0;
+		}
+#endif
+		blocked = n != skip && hit > EPSILON && hit < maxT;
+	}
+	return blocked;
 }
 
-//main
-void main(){
+//same weights as the environment cdf tables
+float luminance(vec3 color){
+	return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+#if HAS_ENV_MAP
+//equirectangular coordinates of a unit direction, phi around y from +x towards +z
+vec2 envCoord(vec3 dir){
+	return vec2(fract(atan(dir.z, dir.x)*(0.5*INV_PI) + 1.0), acos(clamp(dir.y, -1.0, 1.0))*INV_PI);
+}
+
+vec3 envDirection(vec2 uv){
+	float phi = 6.28318530718*uv.x, theta = 3.14159265359*uv.y;
+	return vec3(sin(theta)*cos(phi), cos(theta), sin(theta)*sin(phi));
+}
+
+//solid angle pdf of sampleEnv picking the texel at uv. the tables weigh each row by sin theta at its center
+float envTexelPdf(vec2 uv){
+	ivec2 size = textureSize(envMap, 0);
+	ivec2 texel = min(ivec2(uv*vec2(size)), size - 1);
+	float sinCenter = sin(3.14159265359*(float(texel.y) + 0.5)/float(size.y));
+	return luminance(texelFetch(envMap, texel, 0).rgb)*envPdfScale*sinCenter/max(sin(3.14159265359*uv.y), 1e-6);
+}
+
+//first entry of a cdf row greater than u, by binary search
+int searchCdf(sampler2D cdf, int row, int count, float u){
+	int lo = 0, hi = count - 1;
+	while (lo < hi){
+		int mid = (lo + hi)/2;
+		if (texelFetch(cdf, ivec2(mid, row), 0).r > u)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return lo;
+}
+
+//picks a direction with probability proportional to the sky's luminance, returning its solid angle pdf
+vec3 sampleEnv(vec2 u, out float pdf){
+	ivec2 size = textureSize(envConditional, 0);
+	int y = searchCdf(envMarginal, 0, size.y, u.y);
+	int x = searchCdf(envConditional, y, size.x, u.x);
+	//where u fell inside the chosen step places the direction within the texel
+	float rowLo = y > 0 ? texelFetch(envMarginal, ivec2(y - 1, 0), 0).r : 0.0, rowHi = texelFetch(envMarginal, ivec2(y, 0), 0).r;
+	float colLo = x > 0 ? texelFetch(envConditional, ivec2(x - 1, y), 0).r : 0.0, colHi = texelFetch(envConditional, ivec2(x, y), 0).r;
+	vec2 offset = clamp(vec2((u.x - colLo)/max(colHi - colLo, 1e-12), (u.y - rowLo)/max(rowHi - rowLo, 1e-12)), 0.0, 0.9999);
+	vec2 uv = (vec2(x, y) + offset)/vec2(size);
+	pdf = envTexelPdf(uv);
+	return envDirection(uv);
+}
+#endif
+
+//radiance arriving from direction dir, which need not be normalized
+vec3 skyColor(vec3 dir){
+	vec3 unitRay = normalize(dir);
+#if HAS_ENV_MAP
+	return textureLod(envMap, envCoord(unitRay), 0.0).rgb;
+#else
+	return (1-unitRay.y)*vec3(1.0,1.0,1.0) + (unitRay.y)*vec3(0.5,0.7,1.0);
+#endif
+}
+
+#if HAS_LIGHTS
+//picks a direction from p towards light n, returning its solid angle pdf and the distance to the light along it.
+//spheres are sampled over the cone they cover, triangles and quads uniformly over their area. a pdf of 0 means p is inside the light
+vec3 sampleLight(int n, vec3 p, vec2 u, out float pdf, out float dist){
+	if (world[n].type == 0){
+		vec3 toCenter = world[n].center.xyz - p;
+		float dist2 = dot(toCenter, toCenter), r2 = world[n].radius*world[n].radius;
+		if (dist2 <= r2){
+			pdf = 0.0;
+			return vec3(0.0);
+		}
+		float cosMax = sqrt(1.0 - r2/dist2);
+		float cosTheta = 1.0 - u.x*(1.0 - cosMax);
+		float sinTheta = sqrt(max(0.0, 1.0 - cosTheta*cosTheta));
+		float phi = 6.28318530718*u.y;
+		vec3 w = toCenter*inversesqrt(dist2);
+		vec3 t = normalize(cross(abs(w.x) > 0.9 ? vec3(0,1,0) : vec3(1,0,0), w));
+		vec3 dir = (t*cos(phi) + cross(w, t)*sin(phi))*sinTheta + w*cosTheta;
+		pdf = 1.0/(6.28318530718*(1.0 - cosMax));
+		//directions grazing the rim can miss by rounding, the nearest surface point is close enough then
+		dist = hitSphere(-toCenter, world[n].radius, dir)[0];
+		if (dist <= 0.0)
+			dist = sqrt(dist2) - world[n].radius;
+		return dir;
+	}
+
+	vec3 A = world[n].A.xyz, edgeB = world[n].B.xyz - A, edgeC = world[n].C.xyz - A;
+	if (world[n].type == 2 && u.x + u.y > 1.0)
+		u = 1.0 - u;
+	vec3 d = A + u.x*edgeB + u.y*edgeC - p;
+	vec3 normal = cross(edgeB, edgeC);
+	float area = length(normal)*(world[n].type == 2 ? 0.5 : 1.0);
+	float dist2 = dot(d, d);
+	vec3 dir = d*inversesqrt(dist2);
+	pdf = dist2/(area*max(abs(dot(normal, dir))/length(normal), 1e-6));
+	dist = sqrt(dist2);
+	return dir;
+}
+
+//solid angle pdf sampleLight would have for the unit direction dir from p, which hits light n after dist
+float lightPdf(int n, vec3 p, vec3 dir, float dist){
+	if (world[n].type == 0){
+		vec3 toCenter = world[n].center.xyz - p;
+		float dist2 = dot(toCenter, toCenter), r2 = world[n].radius*world[n].radius;
+		if (dist2 <= r2)
+			return 0.0;
+		return 1.0/(6.28318530718*(1.0 - sqrt(1.0 - r2/dist2)));
+	}
+
+	vec3 normal = cross(world[n].B.xyz - world[n].A.xyz, world[n].C.xyz - world[n].A.xyz);
+	float area = length(normal)*(world[n].type == 2 ? 0.5 : 1.0);
+	return dist*dist/(area*max(abs(dot(normal, dir))/length(normal), 1e-6));
+}
+#endif
+
+//linear color of the pixel whose center is at fragCoord
+vec3 renderPixel(vec2 fragCoord){
 	vec3 finalColor = vec3(0.0);
+#if TEMPORAL || DENOISE
+	primaryPosition = vec4(0.0);
+	primaryNormal = vec3(0.0);
+#endif
+#if DENOISE
+	primaryAlbedo = vec3(1.0);
+#endif
 
 	for (int i = 0; i < SAMPLES; ++i){
-		vec2 adjCoord = sampleDeflectRand(gl_FragCoord.xy - 0.5*resolution,i);
+		//every frame and sample gets its own stream, so accumulated frames add new samples instead of repeating them.
+		//the sobol seed only changes when accumulation restarts, so a moving camera still sees fresh noise each frame
+		seedRng(uvec2(fragCoord), uint(frame*SAMPLES + i));
+		pixelSeed = pcgHash(uint(fragCoord.x) + pcgHash(uint(fragCoord.y) + pcgHash(uint(frame - accumFrames))));
+		sampleIndex = uint(accumFrames*SAMPLES + i);
+		vec2 adjCoord = fragCoord + sobolSet(0u).xy - 0.5 - 0.5*resolution;
 		vec3 viewRay = viewRot*vec3(adjCoord.x*heightRatio, adjCoord.y*heightRatio, -1.0);
 
-		vec3 color = vec3(1.0);
+		//fraction of light carried back to the eye along the path so far, and the light gathered so far
+		vec3 throughput = vec3(1.0), radiance = vec3(0.0);
 		bool finish = false, escaped = false;
 		int bounces = 0;
 		vec3 eyePos = eye;
+		//ray cone carried along the path for texture lod, starting as the footprint of one pixel
+		float coneWidth = 0.0, coneSpread = heightRatio;
+		//pdf of the last bounce if it was diffuse, lights or sky it reaches are then weighted against having sampled them directly
+		float diffusePdf = 0.0;
 
 		while (!finish){
-			//go through all objects
-			int hitIdx = -1;
-			float hitPt = FLT_MAX;
+			float hitPt;
 			vec3 hitNormal;
+			int hitIdx = closestHit(eyePos, viewRay, hitPt, hitNormal);
 
-			for (int n = 0; n < MAX_OBJ; ++n){
-				if (world[n].type == 0){
-					vec2 hitPts = hitSphere(eyePos-world[n].center.xyz, world[n].radius, viewRay);
-					if (hitPts[0] > EPSILON && hitPts[0] < hitPt){
-						hitIdx = n;
-						hitPt = hitPts[0];
-						hitNormal = sphereNormal(world[n].center.xyz, eyePos+hitPt*viewRay);
-					}
-				}
-				else if (world[n].type == 1){
-					float hit = hitPlane(world[n].normal.xyz, world[n].point.xyz - eyePos, viewRay);
-					if (hit > EPSILON && hit < hitPt){
-						hitIdx = n;
-						hitPt = hit;
-						hitNormal = world[n].normal.xyz;
-					}
+			//direction in xy, fuzz radius or fresnel choice in z, roulette in w
+			vec4 u = sobolSet(uint(bounces + 1));
+
+			if (hitIdx != -1){
+				coneWidth += coneSpread*hitPt*length(viewRay);
+#if TEMPORAL || DENOISE
+				if (i == 0 && bounces == 0){
+					primaryPosition = vec4(eyePos + viewRay*hitPt, 1.0);
+					primaryNormal = normalize(dot(hitNormal, viewRay) < 0.0 ? hitNormal : -hitNormal);
 				}
-				else if (world[n].type == 2){
-					vec3 A = world[n].A.xyz, B = world[n].B.xyz, C = world[n].C.xyz;
-					vec3 normal = normalize(cross(B-A,C-B));
-					float hit = hitPlane(normal, A - eyePos, viewRay);
-					if (hit > EPSILON && hit < hitPt){
-						vec3 p = eyePos + hit*viewRay;
-						if (dot(cross(B-A, p-A),normal) > 0 && dot(cross(C-B, p-B),normal) > 0 && dot(cross(A-C, p-C),normal) > 0){
-							hitIdx = n;
-							hitPt = hit;
-							hitNormal = normal;
-						}
+#endif
+
+#if HAS_LIGHTS
+				vec3 emission = world[hitIdx].emission.rgb;
+				if (emission != vec3(0.0)){
+					//power heuristic against next event estimation, which only covers lights in the list
+					float weight = 1.0;
+					if (diffusePdf > 0.0 && world[hitIdx].emission.w > 0.0){
+						float rayLen = length(viewRay);
+						float pdf = lightPdf(hitIdx, eyePos, viewRay/rayLen, hitPt*rayLen)/float(lightCount);
+						weight = diffusePdf*diffusePdf/(diffusePdf*diffusePdf + pdf*pdf);
 					}
+					radiance += throughput*emission*weight;
 				}
-			} 
+#endif
+				diffusePdf = 0.0;
 
-			if (hitIdx != -1){
+#if HAS_TEXTURE
 				if (world[hitIdx].texId != -1 && world[hitIdx].type == 2){
 					vec3 coeff = eyePos+viewRay*hitPt;
 					mat3 solve = inverse(mat3(world[hitIdx].A.xyz,world[hitIdx].B.xyz,world[hitIdx].C.xyz));
@@ -188,21 +679,69 @@ void main(){
 					mat3x2 uvMat = mat3x2(world[hitIdx].uvA, world[hitIdx].uvB, world[hitIdx].uvC);
 					vec2 uv = uvMat*coeff;
 
-					color *= texture(texArray, vec3(uv,world[hitIdx].texId));
+					float lod = coneLod(hitIdx, coneWidth, hitNormal, viewRay);
+					throughput *= textureLod(texArray, atlasCoord(uv, world[hitIdx].texId, lod), lod).rgb;
 				}					
 				else
-					color *= world[hitIdx].color.rgb;
+#endif
+					throughput *= world[hitIdx].color.rgb;
+#if DENOISE
+				if (i == 0 && bounces == 0)
+					primaryAlbedo = throughput;
+#endif
 
+#if HAS_DIFFUSE
 				if (world[hitIdx].matType == 1){
 					eyePos = eyePos+viewRay*hitPt;
-					viewRay = hitNormal + randInSphere(adjCoord.xy+bounces);
+					//scatter on the side the ray came from
+					vec3 faceNormal = dot(hitNormal, viewRay) < 0 ? hitNormal : -hitNormal;
+#if HAS_LIGHTS
+					//next event estimation: a shadow ray to one point on one light
+					if (lightCount > 0){
+						vec4 lightU = sobolSet(uint(MAX_BOUNCES + 1 + bounces));
+						int pick = min(int(lightU.z*float(lightCount)), lightCount - 1);
+						int lightIdx = lightIds[pick >> 2][pick & 3];
+						float pdf, lightDist;
+						vec3 lightDir = sampleLight(lightIdx, eyePos, lightU.xy, pdf, lightDist);
+						float cosine = dot(lightDir, faceNormal);
+						if (pdf > 0.0 && cosine > 0.0){
+							if (!occluded(eyePos, lightDir, lightDist, lightIdx)){
+								pdf /= float(lightCount);
+								float bsdfPdf = cosine*INV_PI;
+								float weight = pdf*pdf/(pdf*pdf + bsdfPdf*bsdfPdf);
+								radiance += throughput*world[lightIdx].emission.rgb*(cosine*INV_PI*weight/pdf);
+							}
+						}
+					}
+#endif
+#if HAS_ENV_MAP
+					//and a shadow ray towards the sky, picked by brightness
+					vec4 envU = sobolSet(uint(2*MAX_BOUNCES + 1 + bounces));
+					float envPdf;
+					vec3 envDir = sampleEnv(envU.xy, envPdf);
+					float envCosine = dot(envDir, faceNormal);
+					if (envPdf > 0.0 && envCosine > 0.0 && !occluded(eyePos, envDir, FLT_MAX, -1)){
+						float bsdfPdf = envCosine*INV_PI;
+						float weight = envPdf*envPdf/(envPdf*envPdf + bsdfPdf*bsdfPdf);
+						radiance += throughput*skyColor(envDir)*(envCosine*INV_PI*weight/envPdf);
+					}
+#endif
+					viewRay = randCosineHemisphere(faceNormal, u.xy);
+					diffusePdf = max(dot(viewRay, faceNormal), 0.0)*INV_PI;
+					coneSpread = max(coneSpread, DIFFUSE_SPREAD);
 				}
-				else if (world[hitIdx].matType == 2){
+#endif
+#if HAS_REFLECTIVE
+				if (world[hitIdx].matType == 2){
 					eyePos = eyePos+viewRay*hitPt;
-					viewRay = viewRay - 2*dot(hitNormal,viewRay)*hitNormal + world[hitIdx].fuzz*randInSphere(adjCoord.xy+bounces);
+					viewRay = viewRay - 2*dot(hitNormal,viewRay)*hitNormal + world[hitIdx].fuzz*randInSphere(u.xyz);
+					coneSpread += curvatureSpread(hitIdx, coneWidth) + 2*world[hitIdx].fuzz;
 				}
-				else if (world[hitIdx].matType == 3){
+#endif
+#if HAS_DIELECTRIC
+				if (world[hitIdx].matType == 3){
 					eyePos = eyePos+viewRay*hitPt;
+					coneSpread += curvatureSpread(hitIdx, coneWidth);
 
 					float nRatio;
 					float c = dot(hitNormal, viewRay);
@@ -216,7 +755,7 @@ void main(){
 
 					float d = 1-nRatio*nRatio*(1-c*c);
 					if (d > 0){
-						if (rand(adjCoord.xy + bounces) > schlick(abs(dot(hitNormal, normalize(viewRay))), 1.0, world[hitIdx].refIdx)){
+						if (u.z > schlick(abs(dot(hitNormal, normalize(viewRay))), 1.0, world[hitIdx].refIdx)){
 							d = sqrt(d);
 							viewRay = d*hitNormal + nRatio*(viewRay - c*hitNormal);
 						}
@@ -226,6 +765,7 @@ void main(){
 					else
 						viewRay = viewRay - 2*dot(viewRay,hitNormal)*hitNormal;
 				}
+#endif
 			}
 			else{
 				escaped = true;
@@ -235,16 +775,98 @@ void main(){
 			++bounces;
 			if (bounces == MAX_BOUNCES)
 				finish = true;
+			else if (!finish){
+				float maxThroughput = max(throughput.r, max(throughput.g, throughput.b));
+				//constant, so the compiler drops the test when the cutoff is off
+				if (THROUGHPUT_CUTOFF > 0.0 && maxThroughput < THROUGHPUT_CUTOFF)
+					finish = true;
+#if ROULETTE_DEPTH > 0
+				if (!finish && bounces >= ROULETTE_DEPTH){
+					float survive = min(maxThroughput, 1.0);
+					if (u.w >= survive)
+						finish = true;
+					else
+						throughput /= survive;
+				}
+#endif
+			}
 		}
+#if PATH_STATS
+		atomicAdd(pathCount, 1u);
+		atomicAdd(bounceCount, uint(bounces));
+#endif
 
 		if (escaped){
-			vec3 unitRay = viewRay/dot(viewRay,viewRay);
-			color *= (1-unitRay.y)*vec3(1.0,1.0,1.0) + (unitRay.y)*vec3(0.5,0.7,1.0); //multiply by sky color
+			float weight = 1.0;
+#if HAS_ENV_MAP
+			//power heuristic against the sky sample taken at the last diffuse hit
+			if (diffusePdf > 0.0){
+				float pdf = envTexelPdf(envCoord(normalize(viewRay)));
+				weight = diffusePdf*diffusePdf/(diffusePdf*diffusePdf + pdf*pdf);
+			}
+#endif
+			radiance += throughput*skyColor(viewRay)*weight;
 		}
 
-		finalColor += color;
+		finalColor += radiance;
 	}
 
-	float gamma = 2.2;
-	gl_FragColor = vec4(pow(finalColor/SAMPLES, vec3(1/gamma)),1.0);
+	return finalColor/SAMPLES;
+}
+
+void main(){
+#if COMPUTE_PATH
+	ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+#else
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+#endif
+#if CHECKERBOARD
+	//each invocation stands for a pair of pixels and traces the one whose turn it is
+	pixel.x = 2*pixel.x + ((pixel.y + frame) & 1);
+#endif
+#if COMPUTE_PATH || CHECKERBOARD
+	//the dispatch is padded up to whole tiles, and a pair may hang over the edge
+	if (pixel.x >= int(resolution.x) || pixel.y >= int(resolution.y))
+		return;
+#endif
+
+#if ADAPTIVE_SAMPLING
+	//a tile nobody marked last frame has converged. in the compute path a tile is a workgroup, so it ends right away
+	ivec2 tile = pixel/TILE_SIZE;
+	if (accumFrames > ADAPTIVE_MIN_FRAMES && imageLoad(tileMask, tile).r + 1u < uint(accumFrames))
+		return;
+#endif
+
+	vec3 color = renderPixel(vec2(pixel) + 0.5);
+#if ADAPTIVE_SAMPLING
+	float moment = luminance(color)*luminance(color);
+#endif
+#if TEMPORAL || DENOISE
+	imageStore(positionImage, pixel, primaryPosition);
+	imageStore(normalImage, pixel, vec4(primaryNormal, 0.0));
+#endif
+#if DENOISE
+	imageStore(albedoImage, pixel, vec4(primaryAlbedo, 1.0));
+#endif
+#if TEMPORAL
+	imageStore(frameImage, pixel, vec4(color, 1.0));
+#else
+	if (accumFrames > 0)
+		color = mix(imageLoad(accumImage, pixel).rgb, color, 1.0/float(accumFrames + 1));
+	imageStore(accumImage, pixel, vec4(color, 1.0));
+#endif
+
+#if ADAPTIVE_SAMPLING
+	if (accumFrames > 0)
+		moment = mix(imageLoad(momentImage, pixel).r, moment, 1.0/float(accumFrames + 1));
+	imageStore(momentImage, pixel, vec4(moment));
+
+	//standard error of the mean over the frames so far, scaled by the slope of the gamma curve the present pass applies
+	float n = float(accumFrames + 1), mean = luminance(color);
+	float variance = max(moment - mean*mean, 0.0)*n/max(n - 1.0, 1.0);
+	float displayError = sqrt(variance/n)*pow(max(mean, 1e-4), 1.0/2.2 - 1.0)/2.2;
+	//every pixel marks its tile until the estimate can be trusted. all writers of a frame store the same value
+	if (accumFrames < ADAPTIVE_MIN_FRAMES || displayError > ADAPTIVE_THRESHOLD)
+		imageStore(tileMask, tile, uvec4(accumFrames));
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,63 @@
+#include "resolution.h"
+
+#include <cmath>
+#include <algorithm>
+
+ResolutionController::ResolutionController() {
+	highWater = 1.0f;
+	lowWater = 0.7f;
+	settleFrames = 8;
+	skipFrames = 4;
+	budget = 1000.0 / 24;
+	minScale = 0.5f;
+	maxScale = 1.0f;
+	current = 1.0f;
+	reset();
+}
+
+void ResolutionController::configure(double budgetMs, float minS, float maxS) {
+	budget = budgetMs;
+	minScale = std::min(minS, maxS);
+	maxScale = maxS;
+	current = std::max(minScale, std::min(current, maxScale));
+	reset();
+}
+
+void ResolutionController::reset() {
+	sum = 0;
+	frames = 0;
+	skipped = 0;
+}
+
+bool ResolutionController::addFrame(double gpuMs) {
+	if (skipped < skipFrames) {
+		++skipped;
+		return false;
+	}
+	sum += gpuMs;
+	if (++frames < settleFrames)
+		return false;
+
+	double load = sum / frames / budget;
+	reset();
+	if (load <= highWater && load >= lowWater)
+		return false;
+
+	//time goes with the pixel count, the square of the scale. aim for the middle of the band, rounding down to a whole step
+	//so growing never overshoots the budget, and move at least one step
+	double aim = 0.5 * (highWater + lowWater);
+	float next = std::floor(current * (float)std::sqrt(aim / load) / SCALE_STEP + 1e-3f) * SCALE_STEP;
+	if (load > highWater)
+		next = std::min(next, current - SCALE_STEP);
+	else
+		next = std::max(next, current + SCALE_STEP);
+	next = std::max(minScale, std::min(next, maxScale));
+	if (std::fabs(next - current) < 0.5f * SCALE_STEP)
+		return false;
+	current = next;
+	return true;
+}
+
+int ResolutionController::scaled(int size) const {
+	return std::max(1, (int)std::lround(size * current));
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+//picks the fraction of the window's width and height the ray pass renders at, so its gpu time stays near a budget.
+//the scale only moves once the frame time has left a band around the budget for settleFrames frames in a row,
+//and then in steps of SCALE_STEP, so small jitter in the timings never resizes the render targets
+#define SCALE_STEP 0.05f
+
+class ResolutionController {
+public:
+	ResolutionController();
+	//budgetMs of gpu time per frame, scale kept within [minScale, maxScale]
+	void configure(double budgetMs, float minScale, float maxScale);
+	//adds the gpu time of one frame rendered at the current scale, returns true if the scale changed
+	bool addFrame(double gpuMs);
+	//forgets the timings, for when they no longer describe the current scale
+	void reset();
+	float scale() const { return current; }
+	//render size for a window, at least one pixel
+	int scaled(int size) const;
+
+	//frame time as a fraction of the budget above which the scale drops, and below which it grows
+	float highWater, lowWater;
+	//frames averaged before a decision, the first ones after a change are dropped as they may predate it
+	int settleFrames, skipFrames;
+
+private:
+	double budget;
+	float minScale, maxScale, current;
+	double sum;
+	int frames, skipped;
+};
@@ -0,0 +1,11 @@
+#pragma once
+#include <cstdint>
+
+//cpu version of the seed hash in rayShader.frag, used by the sobol scrambling in sobol.cpp
+
+//pcg hash, one round of a 32 bit pcg generator used to scramble seeds
+inline uint32_t pcgHash(uint32_t v) {
+	uint32_t state = v*747796405u + 2891336453u;
+	uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state)*277803737u;
+	return (word >> 22u) ^ word;
+}
@@ -1,20 +1,69 @@
 #include "shader.h"
 
-Shader::Shader() {
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <errno.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+//the secure crt is msvc only
+static int fopen_s(FILE** file, const char* name, const char* mode) {
+	*file = fopen(name, mode);
+	return *file != nullptr ? 0 : errno;
+}
+#endif
+
+//bump when the cache file layout changes
+#define PROGRAM_CACHE_VERSION 1
 
+//GL_KHR_parallel_shader_compile, newer than the bundled glew. the ARB version shares the values
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+typedef void (GLAPIENTRY *MaxShaderCompilerThreadsProc)(GLuint count);
+
+static void deleteProgram(GLuint program, GLuint vp, GLuint fp) {
+	//programs loaded from a binary never had shaders attached
+	if (fp != 0)
+		glDetachShader(program, fp);
+	if (vp != 0)
+		glDetachShader(program, vp);
+
+	glDeleteShader(fp);
+	glDeleteShader(vp);
+	glDeleteProgram(program);
 }
 
-Shader::~Shader() {
-	glDetachShader(shader_id, shader_fp);
-	glDetachShader(shader_id, shader_vp);
+Shader::Shader() {
+	shader_id = 0;
+	shader_vp = 0;
+	shader_fp = 0;
+	pending_id = 0;
+	pending_vp = 0;
+	pending_fp = 0;
+	pendingKey = 0;
+	pendingStart = 0;
+	cacheable = false;
+	compute = false;
+	watchFd = -1;
+	watchTime = 0;
+	lastWatchCheck = 0;
+}
 
-	glDeleteShader(shader_fp);
-	glDeleteShader(shader_vp);
-	glDeleteProgram(shader_id);
+Shader::~Shader() {
+	deleteProgram(shader_id, shader_vp, shader_fp);
+	if (pending_id != 0)
+		deleteProgram(pending_id, pending_vp, pending_fp);
+#ifdef __linux__
+	if (watchFd >= 0)
+		close(watchFd);
+#endif
 }
 
-Shader::Shader(const char *vsFile, const char *fsFile) {
-	init(vsFile, fsFile);
+Shader::Shader(const char *vsFile, const char *fsFile, const std::string& defines) : Shader() {
+	init(vsFile, fsFile, defines);
 }
 
 static char* readTextFile(const char *fileName) {
@@ -22,7 +71,7 @@ static char* readTextFile(const char *fileName) {
 
 	if (fileName != nullptr) {
 		FILE *file = nullptr;
-		fopen_s(&file, fileName, "r+");
+		fopen_s(&file, fileName, "r");
 
 		if (file != nullptr) {
 			fseek(file, 0, SEEK_END);
@@ -41,6 +90,8 @@ static char* readTextFile(const char *fileName) {
 }
 
 static void validateShader(GLuint shader, const char* file = 0) {
+	if (shader == 0)
+		return;
 	const unsigned int BUFFER_SIZE = 2048;
 	char buffer[BUFFER_SIZE];
 	memset(buffer, 0, BUFFER_SIZE);
@@ -70,12 +121,176 @@ static void validateProgram(GLuint program) {
 		std::cerr << "Error validating shader " << program << std::endl;
 }
 
-void Shader::init(const char *vsFile, const char *fsFile) {
-	shader_vp = glCreateShader(GL_VERTEX_SHADER);
-	shader_fp = glCreateShader(GL_FRAGMENT_SHADER);
+static double nowMs() {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//fnv-1a, chained so several strings feed one key
+static unsigned long long hashString(const char* text, unsigned long long hash = 14695981039346656037ull) {
+	for (const char* c = text; c != nullptr && *c != '\0'; ++c) {
+		hash ^= (unsigned char)*c;
+		hash *= 1099511628211ull;
+	}
+	//separator, so moving text between strings changes the key
+	hash ^= 0xff;
+	return hash * 1099511628211ull;
+}
+
+//written in front of the driver's binary in the cache file
+struct ProgramCacheHeader {
+	char magic[4];
+	int version;
+	unsigned long long key;
+	GLenum binaryFormat;
+	GLint length;
+};
+
+//true if the driver can compile and link on its own threads, which also asks it to use as many as it likes
+static bool parallelCompile() {
+	static int supported = -1;
+	if (supported == -1) {
+		supported = 0;
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count && supported == 0; ++i) {
+			const char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+			if (strcmp(name, "GL_KHR_parallel_shader_compile") == 0 || strcmp(name, "GL_ARB_parallel_shader_compile") == 0)
+				supported = 1;
+		}
+
+		MaxShaderCompilerThreadsProc maxThreads = (MaxShaderCompilerThreadsProc)glutGetProcAddress("glMaxShaderCompilerThreadsKHR");
+		if (maxThreads == nullptr)
+			maxThreads = (MaxShaderCompilerThreadsProc)glutGetProcAddress("glMaxShaderCompilerThreadsARB");
+		if (supported == 1 && maxThreads != nullptr)
+			maxThreads(0xFFFFFFFF);
+	}
+	return supported == 1;
+}
+
+static long long sourceTime(const std::string& file) {
+	struct stat info;
+	return stat(file.c_str(), &info) == 0 ? (long long)info.st_mtime : 0;
+}
+
+static std::string baseName(const std::string& path) {
+	size_t slash = path.find_last_of("/\\");
+	return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+bool Shader::loadBinary(GLuint program, unsigned long long key) {
+	FILE* file = nullptr;
+	fopen_s(&file, cacheFile.c_str(), "rb");
+	if (file == nullptr)
+		return false;
+
+	ProgramCacheHeader header;
+	std::vector<char> binary;
+	bool ok = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "RTPB", 4) == 0 &&
+		header.version == PROGRAM_CACHE_VERSION && header.key == key && header.length > 0;
+	if (ok) {
+		binary.resize(header.length);
+		ok = fread(binary.data(), 1, binary.size(), file) == binary.size();
+	}
+	fclose(file);
+	if (!ok)
+		return false;
+
+	//the driver may still refuse a binary it wrote, e.g. after an update that kept the version string
+	glProgramBinary(program, header.binaryFormat, binary.data(), header.length);
+	GLint status = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	return status == GL_TRUE;
+}
+
+void Shader::saveBinary(GLuint program, unsigned long long key) {
+	GLint status = GL_FALSE, length = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (status != GL_TRUE || length <= 0)
+		return;
+
+	ProgramCacheHeader header;
+	memcpy(header.magic, "RTPB", 4);
+	header.version = PROGRAM_CACHE_VERSION;
+	header.key = key;
+	std::vector<char> binary(length);
+	glGetProgramBinary(program, length, &header.length, &header.binaryFormat, binary.data());
+	if (header.length <= 0)
+		return;
+
+	FILE* file = nullptr;
+	fopen_s(&file, cacheFile.c_str(), "wb");
+	if (file == nullptr)
+		return;
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(binary.data(), 1, header.length, file);
+	fclose(file);
+}
+
+unsigned long long Shader::programKey(const char* vsText, const char* fsText) const {
+	//binaries are only valid for the driver that produced them, so it is part of the key with the sources and defines
+	unsigned long long key = hashString(vsText);
+	key = hashString(fsText, key);
+	key = hashString(defines.c_str(), key);
+	key = hashString((const char*)glGetString(GL_VENDOR), key);
+	key = hashString((const char*)glGetString(GL_RENDERER), key);
+	return hashString((const char*)glGetString(GL_VERSION), key);
+}
 
-	const char* vsText = readTextFile(vsFile);
-	const char* fsText = readTextFile(fsFile);
+//glsl wants #version first, so defines go right after it and a #line keeps compile errors pointing at the file's own lines
+static GLuint compileStage(GLenum type, const char* text, const std::string& defines) {
+	std::string source = text;
+	if (!defines.empty()) {
+		size_t insertAt = 0, version = source.find("#version");
+		if (version != std::string::npos) {
+			insertAt = source.find('\n', version);
+			if (insertAt == std::string::npos) {
+				insertAt = source.size();
+				source += '\n';
+			}
+			++insertAt;
+		}
+		int line = (int)std::count(source.begin(), source.begin() + insertAt, '\n') + 1;
+		source.insert(insertAt, defines + "\n#line " + std::to_string(line) + "\n");
+	}
+
+	GLuint shader = glCreateShader(type);
+	const char* sourceText = source.c_str();
+	glShaderSource(shader, 1, &sourceText, NULL);
+	glCompileShader(shader);
+	return shader;
+}
+
+void Shader::startCompile(GLuint program, const char* vsText, const char* fsText, GLuint& vp, GLuint& fp) {
+	vp = fp = 0;
+	if (vsText != nullptr) {
+		vp = compileStage(GL_VERTEX_SHADER, vsText, defines);
+		glAttachShader(program, vp);
+	}
+	if (fsText != nullptr) {
+		fp = compileStage(compute ? GL_COMPUTE_SHADER : GL_FRAGMENT_SHADER, fsText, defines);
+		glAttachShader(program, fp);
+	}
+	glLinkProgram(program);
+}
+
+bool Shader::finishCompile(GLuint program, GLuint vp, GLuint fp) {
+	validateShader(vp, vsPath.c_str());
+	validateShader(fp, fsPath.c_str());
+	validateProgram(program);
+
+	GLint status = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	return status == GL_TRUE;
+}
+
+void Shader::init(const char *vsFile, const char *fsFile, const std::string& defineLines) {
+	double start = nowMs();
+	vsPath = vsFile;
+	fsPath = fsFile;
+	defines = defineLines;
+	char* vsText = readTextFile(vsFile);
+	char* fsText = readTextFile(fsFile);
 
 	if (vsText == nullptr && fsText == nullptr) {
 		std::cerr << "Both vertex and fragment shader not found. At least one must be present." << std::endl;
@@ -83,32 +298,189 @@ void Shader::init(const char *vsFile, const char *fsFile) {
 	}
 
 	shader_id = glCreateProgram();
+	name = fsText != nullptr ? fsPath : vsPath;
 
-	if (vsText != nullptr) {
-		glShaderSource(shader_vp, 1, &vsText, NULL);
+	GLint binaryFormats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormats);
+	cacheable = binaryFormats > 0;
+	unsigned long long key = programKey(vsText, fsText);
 
-		glCompileShader(shader_vp);
-		validateShader(shader_vp, vsFile);
+	//every define set gets its own file, so switching between variants never evicts one
+	cacheFile = name;
+	if (!defines.empty()) {
+		char variant[20];
+		snprintf(variant, sizeof(variant), ".%016llx", hashString(defines.c_str()));
+		cacheFile += variant;
+	}
+	cacheFile += ".bin";
 
-		glAttachShader(shader_id, shader_vp);
+	if (cacheable && loadBinary(shader_id, key)) {
+		printf("shader %s: linked from program binary in %.1f ms\n", name.c_str(), nowMs() - start);
 	}
-	if (fsText != nullptr) {
-		glShaderSource(shader_fp, 1, &fsText, NULL);
+	else {
+		if (cacheable)
+			glProgramParameteri(shader_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		startCompile(shader_id, vsText, fsText, shader_vp, shader_fp);
+		bool saved = finishCompile(shader_id, shader_vp, shader_fp) && cacheable;
+		if (saved)
+			saveBinary(shader_id, key);
+		printf("shader %s: compiled from source in %.1f ms%s\n", name.c_str(), nowMs() - start, saved ? ", binary cached" : "");
+	}
+	reflect();
 
-		glCompileShader(shader_fp);
-		validateShader(shader_fp, fsFile);
+	free(vsText);
+	free(fsText);
 
-		glAttachShader(shader_id, shader_fp);
+	//editors often save by renaming over the file, so the whole directory is watched and events are matched by name
+#ifdef __linux__
+	watchFd = inotify_init1(IN_NONBLOCK);
+	for (const std::string& file : { vsPath, fsPath }) {
+		size_t slash = file.find_last_of("/\\");
+		std::string dir = slash == std::string::npos ? "." : file.substr(0, slash);
+		if (watchFd >= 0 && sourceTime(file) != 0)
+			inotify_add_watch(watchFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
 	}
+#else
+	watchTime = std::max(sourceTime(vsPath), sourceTime(fsPath));
+#endif
+}
 
-	glLinkProgram(shader_id);
-	validateProgram(shader_id);
+void Shader::initCompute(const char *csFile, const std::string& defineLines) {
+	compute = true;
+	init("None", csFile, defineLines);
+}
+
+bool Shader::sourcesChanged() {
+#ifdef __linux__
+	if (watchFd < 0)
+		return false;
+	alignas(struct inotify_event) char buffer[4096];
+	bool changed = false;
+	ssize_t length;
+	while ((length = read(watchFd, buffer, sizeof(buffer))) > 0) {
+		for (char* event = buffer; event < buffer + length; event += sizeof(struct inotify_event) + ((struct inotify_event*)event)->len) {
+			struct inotify_event* info = (struct inotify_event*)event;
+			if (info->len > 0 && (baseName(vsPath) == info->name || baseName(fsPath) == info->name))
+				changed = true;
+		}
+	}
+	return changed;
+#else
+	//modification times, a few times a second is plenty for edits by hand
+	double now = nowMs();
+	if (now - lastWatchCheck < 250)
+		return false;
+	lastWatchCheck = now;
+	long long latest = std::max(sourceTime(vsPath), sourceTime(fsPath));
+	if (latest == watchTime)
+		return false;
+	watchTime = latest;
+	return true;
+#endif
+}
+
+void Shader::startReload() {
+	char* vsText = readTextFile(vsPath.c_str());
+	char* fsText = readTextFile(fsPath.c_str());
+	if (vsText == nullptr && fsText == nullptr) {
+		printf("shader %s: sources unreadable, reload skipped\n", name.c_str());
+		return;
+	}
+
+	//a newer edit replaces a compile still in flight
+	if (pending_id != 0)
+		deleteProgram(pending_id, pending_vp, pending_fp);
+
+	pendingStart = nowMs();
+	pendingKey = programKey(vsText, fsText);
+	pending_id = glCreateProgram();
+	if (cacheable)
+		glProgramParameteri(pending_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	startCompile(pending_id, vsText, fsText, pending_vp, pending_fp);
+
+	free(vsText);
+	free(fsText);
+}
+
+bool Shader::pollReload() {
+	if (shader_id != 0 && sourcesChanged())
+		startReload();
+	if (pending_id == 0)
+		return false;
+
+	//without the extension the status queries below simply wait for the compiler
+	if (parallelCompile()) {
+		GLint complete = GL_FALSE;
+		glGetProgramiv(pending_id, GL_COMPLETION_STATUS_KHR, &complete);
+		if (complete == GL_FALSE)
+			return false;
+	}
+
+	bool linked = finishCompile(pending_id, pending_vp, pending_fp);
+	if (linked) {
+		deleteProgram(shader_id, shader_vp, shader_fp);
+		shader_id = pending_id;
+		shader_vp = pending_vp;
+		shader_fp = pending_fp;
+		if (cacheable)
+			saveBinary(shader_id, pendingKey);
+		reflect();
+		printf("shader %s: reloaded in %.1f ms\n", name.c_str(), nowMs() - pendingStart);
+	}
+	else {
+		printf("shader %s: reload failed, keeping the running program\n", name.c_str());
+		deleteProgram(pending_id, pending_vp, pending_fp);
+	}
+	pending_id = pending_vp = pending_fp = 0;
+	return linked;
 }
 
 GLuint Shader::id() {
 	return shader_id;
 }
 
+void Shader::reflect() {
+	uniforms.clear();
+	blocks.clear();
+
+	GLint count = 0, length = 0;
+	glGetProgramiv(shader_id, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(shader_id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &length);
+	std::vector<char> buffer(std::max(length, 1));
+	for (GLint i = 0; i < count; ++i) {
+		GLint size;
+		GLenum type;
+		glGetActiveUniform(shader_id, i, (GLsizei)buffer.size(), nullptr, &size, &type, buffer.data());
+		//block members have no location of their own
+		GLint location = glGetUniformLocation(shader_id, buffer.data());
+		if (location == -1)
+			continue;
+		//arrays are reported as name[0], keep them under their plain name
+		std::string uniformName = buffer.data();
+		if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+			uniformName.resize(uniformName.size() - 3);
+		uniforms[uniformName] = location;
+	}
+
+	glGetProgramiv(shader_id, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+	glGetProgramiv(shader_id, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &length);
+	buffer.assign(std::max(length, 1), '\0');
+	for (GLint i = 0; i < count; ++i) {
+		glGetActiveUniformBlockName(shader_id, i, (GLsizei)buffer.size(), nullptr, buffer.data());
+		blocks[buffer.data()] = (GLuint)i;
+	}
+}
+
+GLint Shader::uniform(const std::string& uniformName) const {
+	auto found = uniforms.find(uniformName);
+	return found == uniforms.end() ? -1 : found->second;
+}
+
+GLuint Shader::block(const std::string& blockName) const {
+	auto found = blocks.find(blockName);
+	return found == blocks.end() ? GL_INVALID_INDEX : found->second;
+}
+
 void Shader::bind() {
 	glUseProgram(shader_id);
 }
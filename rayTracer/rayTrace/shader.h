@@ -5,19 +5,60 @@
 #include <GL/glew.h>
 #include <GL/freeglut.h>
 #include <iostream>
+#include <string>
+#include <map>
 
 class Shader {
 public:
 	Shader();
 	~Shader();
-	Shader(const char*vsFile, const char *fsFile);
-	void init(const char *vsFile, const char *fsFile);
+	Shader(const char*vsFile, const char *fsFile, const std::string& defines = "");
+	//links from a cached program binary when one matches the sources, defines and driver, otherwise compiles and refreshes the cache.
+	//defines are #define lines placed after the #version line of both stages
+	void init(const char *vsFile, const char *fsFile, const std::string& defines = "");
+	//same, for a program with only a compute stage
+	void initCompute(const char *csFile, const std::string& defines = "");
+	//picks up edits to the source files. a changed program is rebuilt in the background and swapped in only once it links,
+	//compile errors are printed and the running program stays. returns true on the call that swaps, call between frames
+	bool pollReload();
 	void bind();
 	void unbind();
 	GLuint id();
+	//locations and block indices reflected when the program linked, -1 and GL_INVALID_INDEX if the name is not active
+	GLint uniform(const std::string& uniformName) const;
+	GLuint block(const std::string& blockName) const;
 
 private:
+	void reflect();
+	void startCompile(GLuint program, const char* vsText, const char* fsText, GLuint& vp, GLuint& fp);
+	bool finishCompile(GLuint program, GLuint vp, GLuint fp);
+	unsigned long long programKey(const char* vsText, const char* fsText) const;
+	bool loadBinary(GLuint program, unsigned long long key);
+	void saveBinary(GLuint program, unsigned long long key);
+	bool sourcesChanged();
+	void startReload();
+
 	GLuint shader_id;
 	GLuint shader_vp;
 	GLuint shader_fp;
+	std::map<std::string, GLint> uniforms;
+	std::map<std::string, GLuint> blocks;
+
+	std::string vsPath, fsPath, defines;
+	std::string name; //the source used in messages and for the cache file
+	std::string cacheFile;
+	bool cacheable;
+	bool compute; //fsPath holds a compute stage
+
+	//rebuild in flight after an edit
+	GLuint pending_id;
+	GLuint pending_vp;
+	GLuint pending_fp;
+	unsigned long long pendingKey;
+	double pendingStart;
+
+	//inotify descriptor on linux, source modification times elsewhere
+	int watchFd;
+	long long watchTime;
+	double lastWatchCheck;
 };
\ No newline at end of file
@@ -0,0 +1,72 @@
+#include "sobol.h"
+#include "rng.h"
+
+//degree, coefficients and initial direction numbers of the primitive polynomials for dimensions 1 and up.
+//dimension 0 is the van der corput sequence and needs none
+struct SobolPolynomial {
+	int degree;
+	uint32_t coefficients;
+	uint32_t initial[3];
+};
+static const SobolPolynomial polynomials[SOBOL_DIMS - 1] = {
+	{ 1, 0, { 1 } },
+	{ 2, 1, { 1, 3 } },
+	{ 3, 1, { 1, 3, 1 } },
+};
+
+void buildSobolDirections(uint32_t directions[SOBOL_BITS][SOBOL_DIMS]) {
+	for (int bit = 0; bit < SOBOL_BITS; ++bit)
+		directions[bit][0] = 1u << (31 - bit);
+
+	for (int dim = 1; dim < SOBOL_DIMS; ++dim) {
+		const SobolPolynomial& poly = polynomials[dim - 1];
+		int s = poly.degree;
+		for (int bit = 0; bit < SOBOL_BITS; ++bit) {
+			uint32_t v;
+			if (bit < s)
+				v = poly.initial[bit] << (31 - bit);
+			else {
+				v = directions[bit - s][dim] ^ (directions[bit - s][dim] >> s);
+				for (int k = 1; k < s; ++k)
+					if ((poly.coefficients >> (s - 1 - k)) & 1)
+						v ^= directions[bit - k][dim];
+			}
+			directions[bit][dim] = v;
+		}
+	}
+}
+
+static uint32_t reverseBits(uint32_t x) {
+	x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+	x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+	x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+	x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+	return (x >> 16) | (x << 16);
+}
+
+//laine and karras' hash, on reversed bits each output bit only depends on the input bits below it
+static uint32_t laineKarras(uint32_t x, uint32_t seed) {
+	x += seed;
+	x ^= x*0x6c50b47cu;
+	x ^= x*0xb82f1e52u;
+	x ^= x*0xc7afe638u;
+	x ^= x*0x8d22f6e6u;
+	return x;
+}
+
+uint32_t owenScramble(uint32_t x, uint32_t seed) {
+	return reverseBits(laineKarras(reverseBits(x), seed));
+}
+
+void sobolSet(const uint32_t directions[SOBOL_BITS][SOBOL_DIMS], uint32_t index, uint32_t pixelSeed, uint32_t set, float out[SOBOL_DIMS]) {
+	uint32_t seed = pcgHash(pixelSeed + set);
+	//shuffling the index keeps the first 2^k points of a set inside one aligned block, so they stay stratified
+	index = owenScramble(index, seed);
+	uint32_t x[SOBOL_DIMS] = {};
+	for (int bit = 0; index != 0; ++bit, index >>= 1)
+		if (index & 1)
+			for (int dim = 0; dim < SOBOL_DIMS; ++dim)
+				x[dim] ^= directions[bit][dim];
+	for (int dim = 0; dim < SOBOL_DIMS; ++dim)
+		out[dim] = (float)(owenScramble(x[dim], pcgHash(seed + dim + 1)) >> 8)*(1.0f/16777216.0f);
+}
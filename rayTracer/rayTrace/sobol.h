@@ -0,0 +1,16 @@
+#pragma once
+#include <cstdint>
+
+//dimensions per sobol point. the ray shader draws one point for the camera and one per bounce, each with its own scramble
+#define SOBOL_DIMS 4
+//direction numbers per dimension, one per bit of the point index
+#define SOBOL_BITS 32
+
+//fills directions[bit][dim] from joe and kuo's primitive polynomials, laid out like the sobolDirections uniform in rayShader.frag
+void buildSobolDirections(uint32_t directions[SOBOL_BITS][SOBOL_DIMS]);
+
+//hash based owen scrambling: every bit of x is flipped by a random choice depending on the bits above it
+uint32_t owenScramble(uint32_t x, uint32_t seed);
+
+//cpu twin of sobolSet in rayShader.frag, the four dimensions of point index for one set of a pixel
+void sobolSet(const uint32_t directions[SOBOL_BITS][SOBOL_DIMS], uint32_t index, uint32_t pixelSeed, uint32_t set, float out[SOBOL_DIMS]);
@@ -0,0 +1,381 @@
+#include "textureLoader.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <algorithm>
+#include <sys/stat.h>
+#include <soil.h>
+
+static double nowMs() {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool readImageSize(const char filename[], int& width, int& height) {
+	FILE* file = nullptr;
+	fopen_s(&file, filename, "rb");
+	if (file == nullptr)
+		return false;
+
+	//png signature, then the IHDR chunk with big endian width and height
+	unsigned char header[24];
+	bool ok = fread(header, 1, 24, file) == 24 && memcmp(header, "\x89PNG\r\n\x1a\n", 8) == 0 && memcmp(header + 12, "IHDR", 4) == 0;
+	fclose(file);
+	if (!ok)
+		return false;
+
+	width = (header[16] << 24) | (header[17] << 16) | (header[18] << 8) | header[19];
+	height = (header[20] << 24) | (header[21] << 16) | (header[22] << 8) | header[23];
+	return width > 0 && height > 0;
+}
+
+static int mipSize(int size, int level) {
+	return std::max(1, size >> level);
+}
+
+//compressed uploads cover whole blocks
+static int blockAlign(int size) {
+	return (size + 3) & ~3;
+}
+
+void buildMipChain(const unsigned char* pixels, int width, int height, int levelCount, std::vector<unsigned char>& mips) {
+	size_t total = 0;
+	for (int l = 1; l < levelCount; ++l)
+		total += (size_t)mipSize(width, l) * mipSize(height, l) * 4;
+	mips.resize(total);
+
+	const unsigned char* src = pixels;
+	unsigned char* dst = mips.data();
+	for (int l = 1; l < levelCount; ++l) {
+		int sw = mipSize(width, l - 1), sh = mipSize(height, l - 1);
+		int dw = mipSize(width, l), dh = mipSize(height, l);
+		for (int y = 0; y < dh; ++y)
+			for (int x = 0; x < dw; ++x) {
+				//2x2 box, clamped so odd sizes reuse their last row and column
+				int x0 = std::min(2 * x, sw - 1), x1 = std::min(2 * x + 1, sw - 1);
+				int y0 = std::min(2 * y, sh - 1), y1 = std::min(2 * y + 1, sh - 1);
+				for (int c = 0; c < 4; ++c) {
+					int sum = src[(y0 * sw + x0) * 4 + c] + src[(y0 * sw + x1) * 4 + c] + src[(y1 * sw + x0) * 4 + c] + src[(y1 * sw + x1) * 4 + c];
+					dst[(y * dw + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+				}
+			}
+		src = dst;
+		dst += (size_t)dw * dh * 4;
+	}
+}
+
+TextureLoader::TextureLoader() {
+	pageSize = 0;
+	mipLevels = 1;
+	format = FORMAT_RGBA8;
+	texArray = 0;
+	pbos[0] = pbos[1] = 0;
+	nextPbo = 0;
+	uploaded = 0;
+	startTime = 0;
+	nextFile = 0;
+}
+
+TextureLoader::~TextureLoader() {
+	for (std::thread& worker : workers)
+		worker.join();
+	for (Decoded& image : decoded)
+		SOIL_free_image_data(image.pixels);
+}
+
+void TextureLoader::load(const std::vector<std::string>& fileList, BlockFormat requested, int threadCount) {
+	files = fileList;
+	format = requested;
+	if (!formatSupported(format)) {
+		printf("textures: %s is not supported by this context, using RGBA8\n", formatName(format));
+		format = FORMAT_RGBA8;
+	}
+	uploaded = 0;
+	nextFile = 0;
+	startTime = nowMs();
+	if (files.empty())
+		return;
+
+	//headers give the sizes up front, only non-png files need decoding to find theirs
+	std::vector<int> widths(files.size(), 1), heights(files.size(), 1);
+	int largestWidth = 1, largestHeight = 1;
+	for (size_t i = 0; i < files.size(); ++i) {
+		if (!readImageSize(files[i].c_str(), widths[i], heights[i])) {
+			int channels;
+			unsigned char* probe = SOIL_load_image(files[i].c_str(), &widths[i], &heights[i], &channels, SOIL_LOAD_RGBA);
+			if (probe == nullptr)
+				widths[i] = heights[i] = 1;
+			SOIL_free_image_data(probe);
+		}
+		largestWidth = std::max(largestWidth, widths[i]);
+		largestHeight = std::max(largestHeight, heights[i]);
+	}
+
+	GLint maxSize;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	int layers = packAtlasBest(widths, heights, maxSize, rects, pageSize);
+	if (layers < 0) {
+		printf("textures: an image is larger than the %d texel limit, nothing loaded\n", (int)maxSize);
+		files.clear();
+		return;
+	}
+
+	long long texels = 0;
+	for (size_t i = 0; i < files.size(); ++i)
+		texels += (long long)widths[i] * heights[i];
+	double packedKB = (double)formatImageBytes(format, pageSize, pageSize) * layers / 1024;
+	double uniformKB = 4.0 * largestWidth * largestHeight * files.size() / 1024;
+	printf("textures: %d images in %d layers of %dx%d %s, %.0f KB instead of %.0f KB as uniform rgba8 (%.0f%% saved), %.0f%% of texels used\n",
+		(int)files.size(), layers, pageSize, pageSize, formatName(format), packedKB, uniformKB, 100.0 * (1.0 - packedKB / uniformKB), 100.0 * texels / ((double)pageSize * pageSize * layers));
+
+	int maxLevels = format == FORMAT_RGBA8 ? MIP_LEVELS : COMPRESSED_MIP_LEVELS;
+	mipLevels = 1;
+	while (mipLevels < maxLevels && (pageSize >> mipLevels) > 0)
+		++mipLevels;
+
+	glGenTextures(1, &texArray);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texArray);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, mipLevels, formatInternal(format), pageSize, pageSize, layers);
+
+	//grey placeholders until the real pixels arrive
+	const unsigned char grey[4] = { 128, 128, 128, 255 };
+	if (format == FORMAT_RGBA8) {
+		for (int l = 0; l < mipLevels; ++l)
+			glClearTexImage(texArray, l, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+	}
+	else {
+		//compressed storage cannot be cleared, so one grey block is repeated over every level
+		unsigned char greyPixels[16 * 4];
+		for (int i = 0; i < 16; ++i)
+			memcpy(greyPixels + 4 * i, grey, 4);
+		std::vector<unsigned char> greyBlock, page;
+		compressImage(greyPixels, 4, 4, format, greyBlock, 1);
+		for (int l = 0; l < mipLevels; ++l) {
+			int size = mipSize(pageSize, l);
+			size_t bytes = formatImageBytes(format, size, size) * layers;
+			page.resize(bytes);
+			for (size_t i = 0; i < bytes; i += greyBlock.size())
+				memcpy(page.data() + i, greyBlock.data(), greyBlock.size());
+			glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, 0, size, size, layers, formatInternal(format), (GLsizei)bytes, page.data());
+		}
+	}
+
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, mipLevels - 1);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glGenBuffers(2, pbos);
+
+	if (threadCount <= 0)
+		threadCount = (int)std::max(1u, std::thread::hardware_concurrency());
+	threadCount = std::min(threadCount, (int)files.size());
+	for (int i = 0; i < threadCount; ++i)
+		workers.push_back(std::thread(&TextureLoader::workerLoop, this));
+}
+
+void TextureLoader::setUniforms(GLuint program) const {
+	//scale and offset in xy and zw, so the shader maps a texture's uv with uv*rect.xy + rect.zw
+	std::vector<float> texRects(4 * MAX_TEX, 0.0f);
+	std::vector<int> texLayers(MAX_TEX, 0);
+	for (int i = 0; i < (int)rects.size() && i < MAX_TEX; ++i) {
+		texRects[4 * i] = (float)rects[i].width / pageSize;
+		texRects[4 * i + 1] = (float)rects[i].height / pageSize;
+		texRects[4 * i + 2] = (float)rects[i].x / pageSize;
+		texRects[4 * i + 3] = (float)rects[i].y / pageSize;
+		texLayers[i] = rects[i].layer;
+	}
+	glUniform4fv(glGetUniformLocation(program, "texRects"), MAX_TEX, texRects.data());
+	glUniform1iv(glGetUniformLocation(program, "texLayers"), MAX_TEX, texLayers.data());
+}
+
+//written in front of the blocks in a .cache file
+struct TextureCacheHeader {
+	char magic[4];
+	int version;
+	long long sourceSize, sourceTime;
+	int format, levels, width, height;
+	long long dataSize;
+};
+
+#define TEXTURE_CACHE_VERSION 1
+
+static bool sourceStamp(const std::string& file, long long& size, long long& time) {
+	struct stat info;
+	if (stat(file.c_str(), &info) != 0)
+		return false;
+	size = (long long)info.st_size;
+	time = (long long)info.st_mtime;
+	return true;
+}
+
+static std::string cacheName(const std::string& file, BlockFormat format) {
+	return file + "." + formatName(format) + ".cache";
+}
+
+bool TextureLoader::readCache(const std::string& file, Decoded& image) const {
+	long long size, time;
+	if (!sourceStamp(file, size, time))
+		return false;
+
+	FILE* cache = nullptr;
+	fopen_s(&cache, cacheName(file, format).c_str(), "rb");
+	if (cache == nullptr)
+		return false;
+
+	//any mismatch means the source or the encoder changed since the cache was written
+	TextureCacheHeader header;
+	bool ok = fread(&header, sizeof(header), 1, cache) == 1 && memcmp(header.magic, "RTTC", 4) == 0 && header.version == TEXTURE_CACHE_VERSION &&
+		header.sourceSize == size && header.sourceTime == time && header.format == format && header.levels == mipLevels && header.dataSize > 0;
+	if (ok) {
+		image.blocks.resize((size_t)header.dataSize);
+		ok = fread(image.blocks.data(), 1, image.blocks.size(), cache) == image.blocks.size();
+		image.width = header.width;
+		image.height = header.height;
+	}
+	fclose(cache);
+	if (!ok)
+		image.blocks.clear();
+	return ok;
+}
+
+void TextureLoader::writeCache(const std::string& file, const Decoded& image) const {
+	TextureCacheHeader header = {};
+	if (!sourceStamp(file, header.sourceSize, header.sourceTime))
+		return;
+	memcpy(header.magic, "RTTC", 4);
+	header.version = TEXTURE_CACHE_VERSION;
+	header.format = format;
+	header.levels = mipLevels;
+	header.width = image.width;
+	header.height = image.height;
+	header.dataSize = (long long)image.blocks.size();
+
+	FILE* cache = nullptr;
+	fopen_s(&cache, cacheName(file, format).c_str(), "wb");
+	if (cache == nullptr)
+		return;
+	fwrite(&header, sizeof(header), 1, cache);
+	fwrite(image.blocks.data(), 1, image.blocks.size(), cache);
+	fclose(cache);
+}
+
+void TextureLoader::workerLoop() {
+	for (int index = nextFile++; index < (int)files.size(); index = nextFile++) {
+		Decoded image;
+		image.index = index;
+		image.pixels = nullptr;
+		image.width = image.height = 0;
+		image.decodeMs = image.mipMs = image.encodeMs = 0;
+		image.cached = format != FORMAT_RGBA8 && readCache(files[index], image);
+
+		if (!image.cached) {
+			double start = nowMs();
+			image.pixels = SOIL_load_image(files[index].c_str(), &image.width, &image.height, 0, SOIL_LOAD_RGBA);
+			image.decodeMs = nowMs() - start;
+
+			start = nowMs();
+			if (image.pixels != nullptr)
+				buildMipChain(image.pixels, image.width, image.height, mipLevels, image.mips);
+			image.mipMs = nowMs() - start;
+
+			//one thread per image here, the pool already keeps every core busy
+			start = nowMs();
+			if (image.pixels != nullptr && format != FORMAT_RGBA8) {
+				std::vector<unsigned char> level;
+				const unsigned char* src = image.pixels;
+				for (int l = 0; l < mipLevels; ++l) {
+					int w = mipSize(image.width, l), h = mipSize(image.height, l);
+					compressImage(src, w, h, format, level, 1);
+					image.blocks.insert(image.blocks.end(), level.begin(), level.end());
+					src = l == 0 ? image.mips.data() : src + (size_t)w * h * 4;
+				}
+				writeCache(files[index], image);
+			}
+			image.encodeMs = nowMs() - start;
+		}
+
+		std::lock_guard<std::mutex> lock(doneMutex);
+		decoded.push_back(std::move(image));
+	}
+}
+
+void TextureLoader::poll() {
+	if (done())
+		return;
+
+	std::vector<Decoded> ready;
+	{
+		std::lock_guard<std::mutex> lock(doneMutex);
+		ready.swap(decoded);
+	}
+
+	for (Decoded& image : ready) {
+		double start = nowMs();
+		const char* file = files[image.index].c_str();
+
+		if (image.pixels == nullptr && image.blocks.empty()) {
+			printf("texture %s: failed to decode, keeping placeholder\n", file);
+		}
+		else if (image.width != rects[image.index].width || image.height != rects[image.index].height) {
+			printf("texture %s: decoded %dx%d but the header said %dx%d, keeping placeholder\n", file, image.width, image.height, rects[image.index].width, rects[image.index].height);
+		}
+		else {
+			//orphan the buffer so the driver never waits on the previous upload from it
+			bool compressed = format != FORMAT_RGBA8;
+			GLsizeiptr baseSize = compressed ? 0 : (GLsizeiptr)image.width * image.height * 4;
+			GLsizeiptr size = compressed ? (GLsizeiptr)image.blocks.size() : baseSize + (GLsizeiptr)image.mips.size();
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[nextPbo]);
+			nextPbo = (nextPbo + 1) % 2;
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+			unsigned char* dst = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+			if (dst != nullptr) {
+				if (compressed) {
+					memcpy(dst, image.blocks.data(), image.blocks.size());
+				}
+				else {
+					memcpy(dst, image.pixels, baseSize);
+					if (!image.mips.empty())
+						memcpy(dst + baseSize, image.mips.data(), image.mips.size());
+				}
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+				glActiveTexture(GL_TEXTURE0);
+				glBindTexture(GL_TEXTURE_2D_ARRAY, texArray);
+				const AtlasRect& rect = rects[image.index];
+				size_t offset = 0;
+				for (int l = 0; l < mipLevels; ++l) {
+					int w = mipSize(image.width, l), h = mipSize(image.height, l);
+					if (compressed) {
+						//edge blocks spill into the rect's alignment padding, never into a neighbour
+						GLsizei bytes = (GLsizei)formatImageBytes(format, w, h);
+						glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, rect.x >> l, rect.y >> l, rect.layer, blockAlign(w), blockAlign(h), 1, formatInternal(format), bytes, (void*)offset);
+						offset += bytes;
+					}
+					else {
+						glTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, rect.x >> l, rect.y >> l, rect.layer, w, h, 1, GL_RGBA, GL_UNSIGNED_BYTE, (void*)offset);
+						offset += (size_t)w * h * 4;
+					}
+				}
+			}
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+			if (image.cached)
+				printf("texture %s: layer %d at %d,%d, %dx%d, %s from cache, upload %.1f ms\n", file, rects[image.index].layer, rects[image.index].x, rects[image.index].y, image.width, image.height, formatName(format), nowMs() - start);
+			else
+				printf("texture %s: layer %d at %d,%d, %dx%d, decode %.1f ms, mips %.1f ms, %s encode %.1f ms, upload %.1f ms\n", file, rects[image.index].layer, rects[image.index].x, rects[image.index].y, image.width, image.height, image.decodeMs, image.mipMs, formatName(format), image.encodeMs, nowMs() - start);
+		}
+
+		SOIL_free_image_data(image.pixels);
+		++uploaded;
+	}
+
+	if (done()) {
+		for (std::thread& worker : workers)
+			worker.join();
+		workers.clear();
+		printf("textures: %d loaded in %.1f ms\n", (int)files.size(), nowMs() - startTime);
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <GL/glew.h>
+#include "atlas.h"
+#include "blockCompress.h"
+
+//largest texId the shader can look up
+#define MAX_TEX 16
+//mip levels generated per texture, limited by ATLAS_ALIGN so lower levels never overlap their neighbours
+#define MIP_LEVELS 6
+//block compressed levels must start on a 4 texel boundary, so with ATLAS_ALIGN 32 only the first 4 levels can be used
+#define COMPRESSED_MIP_LEVELS 4
+
+//reads width and height from an image header without decoding it. png only, false otherwise
+bool readImageSize(const char filename[], int& width, int& height);
+//box filters rgba pixels down into levels 1 to levelCount-1, appended to mips
+void buildMipChain(const unsigned char* pixels, int width, int height, int levelCount, std::vector<unsigned char>& mips);
+
+//decodes images on a pool of threads and streams them into a GL_TEXTURE_2D_ARRAY through pixel buffer objects.
+//images of any size are packed into shared layers, and every layer starts as a grey placeholder so rendering can begin right away.
+//compressed formats are encoded by the same threads and cached next to each image as <file>.<format>.cache
+class TextureLoader {
+public:
+	TextureLoader();
+	~TextureLoader();
+	//packs the images, allocates the array and starts decoding. texIds follow the order of files.
+	//falls back to rgba8 if the context cannot sample format
+	void load(const std::vector<std::string>& files, BlockFormat format = FORMAT_BC7, int threadCount = 0);
+	//uploads each texture's placement to the texRects and texLayers uniforms of a bound program
+	void setUniforms(GLuint program) const;
+	//uploads the images finished since the last call. must run on the thread owning the GL context
+	void poll();
+	bool done() const { return uploaded == (int)files.size(); }
+	GLuint id() const { return texArray; }
+
+private:
+	struct Decoded {
+		int index; //position in files, which is also the texId
+		unsigned char* pixels;
+		std::vector<unsigned char> mips; //levels 1 and up, back to back
+		std::vector<unsigned char> blocks; //every level compressed, back to back. pixels stays null on a cache hit
+		int width, height;
+		double decodeMs, mipMs, encodeMs;
+		bool cached;
+	};
+
+	void workerLoop();
+	//reads or writes the compressed levels of one image, keyed on the source file's size and time
+	bool readCache(const std::string& file, Decoded& image) const;
+	void writeCache(const std::string& file, const Decoded& image) const;
+
+	std::vector<std::string> files;
+	std::vector<AtlasRect> rects;
+	int pageSize;
+	int mipLevels;
+	BlockFormat format;
+	GLuint texArray;
+	GLuint pbos[2];
+	int nextPbo;
+	int uploaded;
+	double startTime;
+
+	std::vector<std::thread> workers;
+	std::atomic<int> nextFile;
+	std::mutex doneMutex;
+	std::vector<Decoded> decoded;
+};
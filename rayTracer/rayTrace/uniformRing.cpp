@@ -0,0 +1,91 @@
+#include "uniformRing.h"
+
+#include <stdlib.h>
+
+UniformRing::UniformRing() {
+	buffer = 0;
+	binding = 0;
+	size = stride = 0;
+	persistent = false;
+	mapped = nullptr;
+	for (int i = 0; i < RING_REGIONS; ++i)
+		fences[i] = 0;
+	region = 0;
+}
+
+UniformRing::~UniformRing() {
+	for (int i = 0; i < RING_REGIONS; ++i)
+		if (fences[i] != 0)
+			glDeleteSync(fences[i]);
+	if (!persistent)
+		free(mapped);
+	else if (buffer != 0) {
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glUnmapBuffer(GL_UNIFORM_BUFFER);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+	glDeleteBuffers(1, &buffer);
+}
+
+void UniformRing::init(GLsizeiptr blockSize, GLuint blockBinding) {
+	size = blockSize;
+	binding = blockBinding;
+
+	GLint alignment = 256;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	stride = (size + alignment - 1) / alignment * alignment;
+
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	persistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+	if (persistent) {
+		//coherent, so writes are visible to the next draw without a flush call
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_UNIFORM_BUFFER, stride * RING_REGIONS, nullptr, flags);
+		mapped = (unsigned char*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, stride * RING_REGIONS, flags);
+		persistent = mapped != nullptr;
+		//immutable storage cannot be respecified or written with glBufferSubData, the fallback needs a fresh buffer
+		if (!persistent) {
+			glDeleteBuffers(1, &buffer);
+			glGenBuffers(1, &buffer);
+			glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		}
+	}
+	if (!persistent) {
+		glBufferData(GL_UNIFORM_BUFFER, stride, nullptr, GL_DYNAMIC_DRAW);
+		mapped = (unsigned char*)calloc(1, size);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void* UniformRing::acquire() {
+	if (!persistent)
+		return mapped;
+
+	//with three regions the fence has almost always passed by the time the region comes around again
+	GLsync& fence = fences[region];
+	if (fence != 0) {
+		while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+		glDeleteSync(fence);
+		fence = 0;
+	}
+	return mapped + stride * region;
+}
+
+void UniformRing::bind() {
+	if (persistent) {
+		glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, stride * region, size);
+		return;
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, size, mapped);
+	glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, 0, size);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void UniformRing::release() {
+	if (!persistent)
+		return;
+	fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	region = (region + 1) % RING_REGIONS;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <GL/glew.h>
+
+//regions in flight, the cpu writes one while the gpu may still read the other two
+#define RING_REGIONS 3
+
+//a uniform block rewritten every frame. the buffer is persistently mapped and split into RING_REGIONS regions,
+//each guarded by a fence, so writes never wait on the driver. falls back to glBufferSubData without GL 4.4 buffer storage
+class UniformRing {
+public:
+	UniformRing();
+	~UniformRing();
+	//allocates the regions for a block of size bytes that shaders read from binding
+	void init(GLsizeiptr size, GLuint binding);
+	//waits until the next region is free and returns it for writing
+	void* acquire();
+	//binds the region written since acquire to the block binding
+	void bind();
+	//marks the region as in use by the draws issued since bind
+	void release();
+
+private:
+	GLuint buffer;
+	GLuint binding;
+	GLsizeiptr size;
+	GLsizeiptr stride; //size rounded up to the offset alignment
+	bool persistent;
+	unsigned char* mapped; //the whole buffer when persistent, a staging copy of one block otherwise
+	GLsync fences[RING_REGIONS];
+	int region;
+};
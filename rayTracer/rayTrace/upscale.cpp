@@ -0,0 +1,277 @@
+#include "upscale.h"
+#include "envMap.h"
+#include "parallel.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <cmath>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+struct Rgb {
+	float r, g, b;
+};
+
+static float clamp01(float x) {
+	return std::min(std::max(x, 0.0f), 1.0f);
+}
+
+static float bitsToFloat(uint32_t u) {
+	float f;
+	memcpy(&f, &u, sizeof(f));
+	return f;
+}
+
+static uint32_t floatToBits(float f) {
+	uint32_t u;
+	memcpy(&u, &f, sizeof(u));
+	return u;
+}
+
+//the same bit tricks as upscale.comp
+static float rcpLow(float a) {
+	return bitsToFloat(0x7ef07ebbu - floatToBits(a));
+}
+
+static float rcpMedium(float a) {
+	float b = bitsToFloat(0x7ef19fffu - floatToBits(a));
+	return b * (-b * a + 2.0f);
+}
+
+static float rsqrtLow(float a) {
+	return bitsToFloat(0x5f347d74u - (floatToBits(a) >> 1));
+}
+
+static float luma2(const Rgb& c) {
+	return c.b * 0.5f + (c.r * 0.5f + c.g);
+}
+
+//texel of an rgba image, clamped to the edge like the shader's loads
+static Rgb texel(const float* image, int width, int height, int x, int y) {
+	const float* p = &image[4 * ((size_t)std::min(std::max(y, 0), height - 1) * width + std::min(std::max(x, 0), width - 1))];
+	return { p[0], p[1], p[2] };
+}
+
+void easuConstants(int srcWidth, int srcHeight, int dstWidth, int dstHeight, float con[4]) {
+	con[0] = (float)srcWidth / (float)dstWidth;
+	con[1] = (float)srcHeight / (float)dstHeight;
+	con[2] = 0.5f * con[0] - 0.5f;
+	con[3] = 0.5f * con[1] - 0.5f;
+}
+
+float rcasSharpness(float stops) {
+	return std::exp2(-stops);
+}
+
+static Rgb easuLoad(const float* src, int width, int height, int x, int y) {
+	Rgb c = texel(src, width, height, x, y);
+	return { std::sqrt(clamp01(c.r)), std::sqrt(clamp01(c.g)), std::sqrt(clamp01(c.b)) };
+}
+
+static void edgeQuadrant(float dir[2], float& len, float w, float a, float b, float c, float d, float e) {
+	float dc = d - c, cb = c - b;
+	float lenX = rcpLow(std::max(std::fabs(dc), std::fabs(cb)));
+	float dirX = d - b;
+	dir[0] += dirX * w;
+	lenX = clamp01(std::fabs(dirX) * lenX);
+	lenX *= lenX;
+	len += lenX * w;
+
+	float ec = e - c, ca = c - a;
+	float lenY = rcpLow(std::max(std::fabs(ec), std::fabs(ca)));
+	float dirY = e - a;
+	dir[1] += dirY * w;
+	lenY = clamp01(std::fabs(dirY) * lenY);
+	lenY *= lenY;
+	len += lenY * w;
+}
+
+static void tap(Rgb& aC, float& aW, float offX, float offY, const float dir[2], const float len2[2], float lob, float clp, const Rgb& c) {
+	float vx = offX * dir[0] + offY * dir[1];
+	float vy = offX * (-dir[1]) + offY * dir[0];
+	vx *= len2[0];
+	vy *= len2[1];
+	float d2 = std::min(vx * vx + vy * vy, clp);
+	float wB = 0.4f * d2 - 1.0f;
+	float wA = lob * d2 - 1.0f;
+	wB *= wB;
+	wA *= wA;
+	wB = 1.5625f * wB - 0.5625f;
+	float w = wB * wA;
+	aC.r += c.r * w;
+	aC.g += c.g * w;
+	aC.b += c.b * w;
+	aW += w;
+}
+
+void easu(const float* src, int srcWidth, int srcHeight, const float con[4], float* dst, int dstWidth, int dstHeight, int threadCount) {
+	forRows(dstHeight, threadCount, [&](int y) {
+		for (int x = 0; x < dstWidth; ++x) {
+			float ppX = (float)x * con[0] + con[2], ppY = (float)y * con[1] + con[3];
+			float fpX = std::floor(ppX), fpY = std::floor(ppY);
+			ppX -= fpX;
+			ppY -= fpY;
+			int px = (int)fpX, py = (int)fpY;
+
+			Rgb b = easuLoad(src, srcWidth, srcHeight, px, py - 1), c = easuLoad(src, srcWidth, srcHeight, px + 1, py - 1);
+			Rgb e = easuLoad(src, srcWidth, srcHeight, px - 1, py), f = easuLoad(src, srcWidth, srcHeight, px, py);
+			Rgb g = easuLoad(src, srcWidth, srcHeight, px + 1, py), h = easuLoad(src, srcWidth, srcHeight, px + 2, py);
+			Rgb i = easuLoad(src, srcWidth, srcHeight, px - 1, py + 1), j = easuLoad(src, srcWidth, srcHeight, px, py + 1);
+			Rgb k = easuLoad(src, srcWidth, srcHeight, px + 1, py + 1), l = easuLoad(src, srcWidth, srcHeight, px + 2, py + 1);
+			Rgb n = easuLoad(src, srcWidth, srcHeight, px, py + 2), o = easuLoad(src, srcWidth, srcHeight, px + 1, py + 2);
+			float bL = luma2(b), cL = luma2(c), eL = luma2(e), fL = luma2(f), gL = luma2(g), hL = luma2(h);
+			float iL = luma2(i), jL = luma2(j), kL = luma2(k), lL = luma2(l), nL = luma2(n), oL = luma2(o);
+
+			float dir[2] = { 0.0f, 0.0f };
+			float len = 0.0f;
+			edgeQuadrant(dir, len, (1.0f - ppX) * (1.0f - ppY), bL, eL, fL, gL, jL);
+			edgeQuadrant(dir, len, ppX * (1.0f - ppY), cL, fL, gL, hL, kL);
+			edgeQuadrant(dir, len, (1.0f - ppX) * ppY, fL, iL, jL, kL, nL);
+			edgeQuadrant(dir, len, ppX * ppY, gL, jL, kL, lL, oL);
+
+			float dirR = dir[0] * dir[0] + dir[1] * dir[1];
+			bool zero = dirR < 1.0f / 32768.0f;
+			dirR = zero ? 1.0f : rsqrtLow(dirR);
+			dir[0] = zero ? 1.0f : dir[0];
+			dir[0] *= dirR;
+			dir[1] *= dirR;
+			len = len * 0.5f;
+			len *= len;
+			float stretch = (dir[0] * dir[0] + dir[1] * dir[1]) * rcpLow(std::max(std::fabs(dir[0]), std::fabs(dir[1])));
+			float len2[2] = { 1.0f + (stretch - 1.0f) * len, 1.0f - 0.5f * len };
+			float lob = 0.5f + (0.21f - 0.5f) * len;
+			float clp = rcpLow(lob);
+
+			Rgb aC = { 0.0f, 0.0f, 0.0f };
+			float aW = 0.0f;
+			tap(aC, aW, 0.0f - ppX, -1.0f - ppY, dir, len2, lob, clp, b);
+			tap(aC, aW, 1.0f - ppX, -1.0f - ppY, dir, len2, lob, clp, c);
+			tap(aC, aW, -1.0f - ppX, 1.0f - ppY, dir, len2, lob, clp, i);
+			tap(aC, aW, 0.0f - ppX, 1.0f - ppY, dir, len2, lob, clp, j);
+			tap(aC, aW, 0.0f - ppX, 0.0f - ppY, dir, len2, lob, clp, f);
+			tap(aC, aW, -1.0f - ppX, 0.0f - ppY, dir, len2, lob, clp, e);
+			tap(aC, aW, 1.0f - ppX, 1.0f - ppY, dir, len2, lob, clp, k);
+			tap(aC, aW, 2.0f - ppX, 1.0f - ppY, dir, len2, lob, clp, l);
+			tap(aC, aW, 2.0f - ppX, 0.0f - ppY, dir, len2, lob, clp, h);
+			tap(aC, aW, 1.0f - ppX, 0.0f - ppY, dir, len2, lob, clp, g);
+			tap(aC, aW, 1.0f - ppX, 2.0f - ppY, dir, len2, lob, clp, o);
+			tap(aC, aW, 0.0f - ppX, 2.0f - ppY, dir, len2, lob, clp, n);
+
+			float* out = &dst[4 * ((size_t)y * dstWidth + x)];
+			out[0] = std::min(std::max(std::max(f.r, g.r), std::max(j.r, k.r)), std::max(std::min(std::min(f.r, g.r), std::min(j.r, k.r)), aC.r / aW));
+			out[1] = std::min(std::max(std::max(f.g, g.g), std::max(j.g, k.g)), std::max(std::min(std::min(f.g, g.g), std::min(j.g, k.g)), aC.g / aW));
+			out[2] = std::min(std::max(std::max(f.b, g.b), std::max(j.b, k.b)), std::max(std::min(std::min(f.b, g.b), std::min(j.b, k.b)), aC.b / aW));
+			out[3] = 1.0f;
+		}
+	});
+}
+
+static float rcasLobe(float mn4, float mx4) {
+	float hitMin = mn4 / std::max(4.0f * mx4, 1e-20f);
+	float hitMax = (1.0f - mx4) / std::min(4.0f * mn4 - 4.0f, -1e-20f);
+	return std::max(-hitMin, hitMax);
+}
+
+void rcas(const float* src, int width, int height, float sharpness, float* dst, int threadCount) {
+	forRows(height, threadCount, [&](int y) {
+		for (int x = 0; x < width; ++x) {
+			Rgb b = texel(src, width, height, x, y - 1), d = texel(src, width, height, x - 1, y), e = texel(src, width, height, x, y);
+			Rgb f = texel(src, width, height, x + 1, y), h = texel(src, width, height, x, y + 1);
+			float bL = luma2(b), dL = luma2(d), eL = luma2(e), fL = luma2(f), hL = luma2(h);
+
+			float lobeR = rcasLobe(std::min(std::min(b.r, d.r), std::min(f.r, h.r)), std::max(std::max(b.r, d.r), std::max(f.r, h.r)));
+			float lobeG = rcasLobe(std::min(std::min(b.g, d.g), std::min(f.g, h.g)), std::max(std::max(b.g, d.g), std::max(f.g, h.g)));
+			float lobeB = rcasLobe(std::min(std::min(b.b, d.b), std::min(f.b, h.b)), std::max(std::max(b.b, d.b), std::max(f.b, h.b)));
+			float lobe = std::max(-0.1875f, std::min(std::max(lobeR, std::max(lobeG, lobeB)), 0.0f)) * sharpness;
+
+			float nz = 0.25f * bL + 0.25f * dL + 0.25f * fL + 0.25f * hL - eL;
+			float range = std::max(std::max(std::max(bL, dL), std::max(eL, fL)), hL) - std::min(std::min(std::min(bL, dL), std::min(eL, fL)), hL);
+			nz = clamp01(std::fabs(nz) * rcpMedium(range));
+			nz = -0.5f * nz + 1.0f;
+			lobe *= nz;
+
+			float rcpL = rcpMedium(4.0f * lobe + 1.0f);
+			float* out = &dst[4 * ((size_t)y * width + x)];
+			float r = (lobe * b.r + lobe * d.r + lobe * h.r + lobe * f.r + e.r) * rcpL;
+			float g = (lobe * b.g + lobe * d.g + lobe * h.g + lobe * f.g + e.g) * rcpL;
+			float bl = (lobe * b.b + lobe * d.b + lobe * h.b + lobe * f.b + e.b) * rcpL;
+			out[0] = r * r;
+			out[1] = g * g;
+			out[2] = bl * bl;
+			out[3] = 1.0f;
+		}
+	});
+}
+
+//psnr after clipping and gamma, what the present pass would show
+static double displayPsnr(const float* a, const float* b, int width, int height) {
+	double sum = 0;
+	for (size_t i = 0; i < (size_t)width * height * 4; ++i) {
+		if (i % 4 == 3)
+			continue;
+		double d = std::pow(clamp01(a[i]), 1 / 2.2) - std::pow(clamp01(b[i]), 1 / 2.2);
+		sum += d * d;
+	}
+	return 10 * std::log10(1.0 / std::max(sum / ((double)width * height * 3), 1e-20));
+}
+
+void benchmarkUpscale(const char filename[], float scale, float stops) {
+	std::vector<float> rgb;
+	int width, height;
+	if (!readHDR(filename, rgb, width, height)) {
+		printf("could not read %s\n", filename);
+		return;
+	}
+	std::vector<float> full((size_t)width * height * 4);
+	for (size_t i = 0; i < (size_t)width * height; ++i) {
+		memcpy(&full[4 * i], &rgb[3 * i], 3 * sizeof(float));
+		full[4 * i + 3] = 1.0f;
+	}
+
+	//box filtered down to the render size, like a path tracer averaging over each larger pixel. edge pixels of the
+	//footprint count by how much of them it covers, so every render pixel spans the same area
+	int smallWidth = std::max(1, (int)std::lround(width * scale)), smallHeight = std::max(1, (int)std::lround(height * scale));
+	std::vector<float> small((size_t)smallWidth * smallHeight * 4, 0.0f);
+	float stepX = (float)width / smallWidth, stepY = (float)height / smallHeight;
+	for (int y = 0; y < smallHeight; ++y)
+		for (int x = 0; x < smallWidth; ++x) {
+			float fx0 = x * stepX, fx1 = (x + 1) * stepX, fy0 = y * stepY, fy1 = (y + 1) * stepY;
+			float* out = &small[4 * ((size_t)y * smallWidth + x)];
+			for (int sy = (int)fy0; sy < std::min((int)std::ceil(fy1), height); ++sy)
+				for (int sx = (int)fx0; sx < std::min((int)std::ceil(fx1), width); ++sx) {
+					float cover = (std::min(sx + 1.0f, fx1) - std::max((float)sx, fx0)) * (std::min(sy + 1.0f, fy1) - std::max((float)sy, fy0));
+					for (int c = 0; c < 4; ++c)
+						out[c] += full[4 * ((size_t)sy * width + sx) + c] * cover / (stepX * stepY);
+				}
+		}
+
+	//bilinear, what the present pass does without the upscaler
+	std::vector<float> bilinear(full.size());
+	for (int y = 0; y < height; ++y)
+		for (int x = 0; x < width; ++x) {
+			float u = (x + 0.5f) * smallWidth / width - 0.5f, v = (y + 0.5f) * smallHeight / height - 0.5f;
+			int x0 = (int)std::floor(u), y0 = (int)std::floor(v);
+			float fx = u - x0, fy = v - y0;
+			for (int c = 0; c < 3; ++c) {
+				auto at = [&](int sx, int sy) { return small[4 * ((size_t)std::min(std::max(sy, 0), smallHeight - 1) * smallWidth + std::min(std::max(sx, 0), smallWidth - 1)) + c]; };
+				bilinear[4 * ((size_t)y * width + x) + c] = (at(x0, y0) * (1 - fx) + at(x0 + 1, y0) * fx) * (1 - fy) + (at(x0, y0 + 1) * (1 - fx) + at(x0 + 1, y0 + 1) * fx) * fy;
+			}
+			bilinear[4 * ((size_t)y * width + x) + 3] = 1.0f;
+		}
+
+	auto start = std::chrono::steady_clock::now();
+	float con[4];
+	easuConstants(smallWidth, smallHeight, width, height, con);
+	std::vector<float> upscaled(full.size()), sharpened(full.size());
+	easu(small.data(), smallWidth, smallHeight, con, upscaled.data(), width, height);
+	auto easuDone = std::chrono::steady_clock::now();
+	rcas(upscaled.data(), width, height, rcasSharpness(stops), sharpened.data());
+	auto rcasDone = std::chrono::steady_clock::now();
+
+	printf("%s: %dx%d rendered at %dx%d (%.0f%% of the pixels)\n", filename, width, height, smallWidth, smallHeight,
+		100.0 * smallWidth * smallHeight / ((double)width * height));
+	printf("bilinear: %.2f dB\n", displayPsnr(bilinear.data(), full.data(), width, height));
+	printf("easu + rcas: %.2f dB, easu %.1f ms, rcas %.1f ms on the cpu\n", displayPsnr(sharpened.data(), full.data(), width, height),
+		std::chrono::duration<double, std::milli>(easuDone - start).count(), std::chrono::duration<double, std::milli>(rcasDone - easuDone).count());
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+//cpu twin of upscale.comp on rgba float images laid out like the textures, for checking the gpu passes and for
+//offline frames. every operation is the shader's, in its order, so the results agree to within the few ulp glsl allows
+//its sqrt and division, about 1e-5, and match bit for bit on drivers that round those exactly (llvmpipe does)
+
+//easuScale of upscale.comp: source pixels per target pixel in [0..1], the source position of target pixel 0 in [2..3]
+void easuConstants(int srcWidth, int srcHeight, int dstWidth, int dstHeight, float con[4]);
+//the rcas sharpness uniform, stops 0 sharpens the most and each stop halves it
+float rcasSharpness(float stops);
+
+//edge adaptive resampling of src to the dst size, in gamma 2 like the shader. rows are split over threadCount threads
+void easu(const float* src, int srcWidth, int srcHeight, const float con[4], float* dst, int dstWidth, int dstHeight, int threadCount = 0);
+//contrast adaptive sharpening of an easu output, back in linear color
+void rcas(const float* src, int width, int height, float sharpness, float* dst, int threadCount = 0);
+
+//offline quality and speed check: shrinks the .hdr image in filename by scale, brings it back with bilinear
+//filtering and with easu + rcas sharpened by stops, and compares both against the original after gamma
+void benchmarkUpscale(const char filename[], float scale, float stops);
@@ -2,6 +2,7 @@
 #include <stdexcept>
 #include <vector>
 #include <cmath>
+#include <ostream>
 
 template <typename component>
 class Vector {